@@ -0,0 +1,160 @@
+#include "user_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+user_index::user_index() : m_size(0), m_next(NULL), m_end(NULL)
+{
+    table *t = new_table(INIT_SLOTS);
+    m_table.store(t, std::memory_order_relaxed);
+}
+
+user_index::~user_index()
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        delete[] m_tables[i]->slots;
+        delete m_tables[i];
+    }
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        free(m_blocks[i]);
+}
+
+//FNV-1a,最后再混合一次,低位用来定位槽,高16位放进槽里做快速比较
+uint64_t user_index::hash_name(const char *name, size_t len)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+const user_index::record *user_index::find(const char *name, size_t len) const
+{
+    uint64_t h = hash_name(name, len);
+    uint64_t tag = h & 0xffff000000000000ULL;
+    const table *t = m_table.load(std::memory_order_acquire);
+    for (size_t i = h & t->mask;; i = (i + 1) & t->mask)
+    {
+        uint64_t v = t->slots[i].load(std::memory_order_acquire);
+        if (0 == v)
+            return NULL;
+        if ((v & 0xffff000000000000ULL) != tag)
+            continue;
+        const record *rec = unpack(v);
+        if (rec->hash == h && rec->name_len == len && 0 == memcmp(rec->data, name, len))
+            return rec;
+    }
+}
+
+bool user_index::contains(const char *name) const
+{
+    return find(name, strlen(name)) != NULL;
+}
+
+bool user_index::verify(const char *name, const char *passwd) const
+{
+    const record *rec = find(name, strlen(name));
+    return rec && 0 == strcmp(rec->passwd(), passwd);
+}
+
+bool user_index::insert(const char *name, const char *passwd)
+{
+    size_t name_len = strlen(name);
+    size_t passwd_len = strlen(passwd);
+    if (name_len > 0xffff || passwd_len > 0xffff)
+        return false;
+
+    m_lock.lock();
+    //加锁后再查一次,两个注册同一用户名的请求只有一个成功
+    if (find(name, name_len))
+    {
+        m_lock.unlock();
+        return false;
+    }
+    record *rec = new_record(hash_name(name, name_len), name, name_len, passwd, passwd_len);
+    if (!rec)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    //装填超过一半时先扩容,保证探测链短且总有空槽
+    table *t = m_table.load(std::memory_order_relaxed);
+    if ((m_size.load(std::memory_order_relaxed) + 1) * 2 > t->mask + 1)
+    {
+        grow();
+        t = m_table.load(std::memory_order_relaxed);
+    }
+    place(t, pack(rec));
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    m_lock.unlock();
+    return true;
+}
+
+//记录从只追加的内存块里分配,8字节对齐,地址一直有效
+user_index::record *user_index::new_record(uint64_t hash, const char *name, size_t name_len,
+                                           const char *passwd, size_t passwd_len)
+{
+    size_t size = (offsetof(record, data) + name_len + passwd_len + 2 + 7) & ~(size_t)7;
+    if ((size_t)(m_end - m_next) < size)
+    {
+        size_t block = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        char *p = (char *)malloc(block);
+        if (!p)
+            return NULL;
+        m_blocks.push_back(p);
+        m_next = p;
+        m_end = p + block;
+    }
+    record *rec = (record *)m_next;
+    m_next += size;
+
+    rec->hash = hash;
+    rec->name_len = name_len;
+    rec->passwd_len = passwd_len;
+    memcpy(rec->data, name, name_len);
+    rec->data[name_len] = '\0';
+    memcpy(rec->data + name_len + 1, passwd, passwd_len);
+    rec->data[name_len + 1 + passwd_len] = '\0';
+    return rec;
+}
+
+user_index::table *user_index::new_table(size_t slots)
+{
+    table *t = new table;
+    t->mask = slots - 1;
+    t->slots = new std::atomic<uint64_t>[slots];
+    for (size_t i = 0; i < slots; ++i)
+        t->slots[i].store(0, std::memory_order_relaxed);
+    m_tables.push_back(t);
+    return t;
+}
+
+//release发布:读者读到这个槽时,记录的内容一定已经写好
+void user_index::place(table *t, uint64_t v)
+{
+    size_t i = unpack(v)->hash & t->mask;
+    while (t->slots[i].load(std::memory_order_relaxed))
+        i = (i + 1) & t->mask;
+    t->slots[i].store(v, std::memory_order_release);
+}
+
+//容量翻倍后整体替换,旧表保留给还在上面探测的读者
+void user_index::grow()
+{
+    table *old = m_table.load(std::memory_order_relaxed);
+    table *t = new_table((old->mask + 1) * 2);
+    for (size_t i = 0; i <= old->mask; ++i)
+    {
+        uint64_t v = old->slots[i].load(std::memory_order_relaxed);
+        if (v)
+            place(t, v);
+    }
+    m_table.store(t, std::memory_order_release);
+}
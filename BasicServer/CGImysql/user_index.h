@@ -0,0 +1,76 @@
+#ifndef USER_INDEX_H
+#define USER_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "../lock/locker.h"
+
+//user表在内存中的索引,登录时按用户名查密码,注册时插入
+//开放寻址(线性探测)的扁平哈希表,槽里是记录指针和哈希值的高16位,比较前不用解引用
+//读多写少:查询不加锁,读一次当前表的指针后只做原子读;写者由互斥锁串行化,同一时刻只有一个
+//  记录写好后才以release发布到槽里,读者要么看不到、要么看到完整的记录
+//  扩容时写者建好新表再整体替换,旧表和记录都不释放,还在旧表上探测的读者看到的只是稍旧的快照
+class user_index
+{
+public:
+    static user_index *get_instance()
+    {
+        static user_index instance;
+        return &instance;
+    }
+
+    bool contains(const char *name) const;
+    //用户存在且密码一致
+    bool verify(const char *name, const char *passwd) const;
+    //用户名已存在时不覆盖,返回false
+    bool insert(const char *name, const char *passwd);
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    user_index();
+    ~user_index();
+
+private:
+    //一条记录:用户名和密码连续存放,都以'\0'结尾
+    struct record
+    {
+        uint64_t hash;
+        unsigned short name_len;
+        unsigned short passwd_len;
+        char data[1];
+        const char *passwd() const { return data + name_len + 1; }
+    };
+
+    struct table
+    {
+        size_t mask;
+        std::atomic<uint64_t> *slots;   //0为空,否则为(hash高16位 << 48) | 记录地址
+    };
+
+    static const size_t INIT_SLOTS = 1024;
+    static const size_t ARENA_BLOCK = 64 * 1024;
+
+    static uint64_t hash_name(const char *name, size_t len);
+    static uint64_t pack(const record *rec) { return (rec->hash & 0xffff000000000000ULL) | (uint64_t)(uintptr_t)rec; }
+    static const record *unpack(uint64_t v) { return (const record *)(uintptr_t)(v & 0x0000ffffffffffffULL); }
+
+    const record *find(const char *name, size_t len) const;
+    record *new_record(uint64_t hash, const char *name, size_t name_len, const char *passwd, size_t passwd_len);
+    table *new_table(size_t slots);
+    void place(table *t, uint64_t v);
+    void grow();
+
+    std::atomic<table *> m_table;
+    std::atomic<size_t> m_size;
+    locker m_lock;                  //写者之间互斥
+
+    //只有写者访问
+    std::vector<table *> m_tables;  //当前和扩容前的全部表,析构时才释放
+    std::vector<char *> m_blocks;   //记录所在的内存块,只追加
+    char *m_next;
+    char *m_end;
+};
+
+#endif
@@ -28,13 +28,37 @@ Config::Config(){
     //关闭日志,默认不关闭
     close_log = 0;
 
-    //并发模型,默认是proactor
+    //并发模型,默认是proactor,1为reactor,2为SO_REUSEPORT多reactor,3为主从reactor
     actor_model = 0;
+
+    //事件循环(主从模式下为从reactor)数量,默认0表示与CPU核数相同,仅多reactor模式有效
+    reactor_num = 0;
+
+    //I/O后端,默认epoll,1为io_uring(内核不支持时回退到epoll)
+    io_backend = 0;
+
+    //定时器检查间隔,默认1000毫秒,可设为亚秒级
+    tick_ms = 1000;
+
+    //惰性刷新定时器,默认关闭,读写事件每次都重新调整定时器
+    lazy_timer = 0;
+
+    //请求队列长度上限,默认10000,超过高水位暂停accept,满了直接回503
+    queue_size = 10000;
+
+    //线程池最大线程数,默认0表示固定为thread_num;大于thread_num时按排队时间在两者之间伸缩
+    thread_max = 0;
+
+    //静态文件发送方式,默认sendfile零拷贝,0为mmap+writev;io_uring后端固定使用mmap
+    send_file = 1;
+
+    //静态文件缓存上限,默认64MB,0为不缓存
+    cache_mb = 64;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:r:i:k:z:q:x:f:b:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -79,6 +103,46 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'r':
+        {
+            reactor_num = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            io_backend = atoi(optarg);
+            break;
+        }
+        case 'k':
+        {
+            tick_ms = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            lazy_timer = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            queue_size = atoi(optarg);
+            break;
+        }
+        case 'x':
+        {
+            thread_max = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            send_file = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            cache_mb = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
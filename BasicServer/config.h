@@ -42,6 +42,30 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //多reactor模式下事件循环(主从模式下为从reactor)数量
+    int reactor_num;
+
+    //I/O后端,0为epoll,1为io_uring
+    int io_backend;
+
+    //定时器检查间隔(毫秒)
+    int tick_ms;
+
+    //惰性刷新keep-alive定时器
+    int lazy_timer;
+
+    //请求队列长度上限
+    int queue_size;
+
+    //线程池最大线程数
+    int thread_max;
+
+    //静态文件发送方式,1为sendfile,0为mmap+writev
+    int send_file;
+
+    //静态文件缓存上限(MB)
+    int cache_mb;
 };
 
 #endif
\ No newline at end of file
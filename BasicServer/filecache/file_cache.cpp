@@ -0,0 +1,496 @@
+#include "file_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#include "../log/log.h"
+
+file_cache::file_cache()
+{
+    m_enabled = false;
+    m_max_bytes = 0;
+    m_bytes = 0;
+    m_gzip_bytes = 0;
+    m_generation = 0;
+    m_inotify_fd = -1;
+    m_close_log = 1;
+}
+
+//监视线程不退出,缓存的fd和映射在进程退出时由内核回收
+file_cache::~file_cache()
+{
+}
+
+bool file_cache::init(const char *root, size_t max_bytes, int close_log)
+{
+    m_root = root;
+    m_max_bytes = max_bytes;
+    m_close_log = close_log;
+    if (0 == m_max_bytes)
+        return true;
+
+    //监视不了根目录时无法保证缓存内容是最新的,不启用缓存
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0 ||
+        inotify_add_watch(m_inotify_fd, root, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM |
+                                                   IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+    {
+        LOG_ERROR("file cache disabled, inotify on %s failed:errno is:%d", root, errno);
+        return false;
+    }
+
+    //先开始监视再压缩,压缩期间的改动由监视线程随后处理
+    build_all_gzip();
+
+    if (pthread_create(&m_tid, NULL, watch_thread, this) != 0)
+        return false;
+    pthread_detach(m_tid);
+    m_enabled = true;
+    return true;
+}
+
+void *file_cache::watch_thread(void *arg)
+{
+    file_cache *cache = (file_cache *)arg;
+    cache->watch();
+    return cache;
+}
+
+//inotify事件到来时把对应文件移出缓存,正在发送它的连接继续使用旧的fd直到发完
+void file_cache::watch()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            //收不到变更通知后缓存可能过期,停用并清空
+            LOG_ERROR("file cache disabled, inotify read error:errno is:%d", errno);
+            m_enabled = false;
+            invalidate_all();
+            return;
+        }
+
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                invalidate_all();
+                build_all_gzip();
+            }
+            else if (ev->len > 0)
+            {
+                invalidate(ev->name);
+                //写的过程中可能有很多次IN_MODIFY,只先丢掉旧的压缩版本,写完或换入新文件后再压缩
+                //预先压缩好的name.gz变化时,按原文件重新选择
+                string name(ev->name);
+                if (name.size() > 3 && 0 == name.compare(name.size() - 3, 3, ".gz"))
+                    name.erase(name.size() - 3);
+                update_gzip(name, ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB));
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+//只缓存根目录下一层的文件,与inotify监视的范围一致
+bool file_cache::cache_name(const char *path, string &name)
+{
+    if (!enabled())
+        return false;
+
+    size_t root_len = m_root.size();
+    if (strncmp(path, m_root.c_str(), root_len) != 0 || path[root_len] != '/')
+        return false;
+    const char *rest = path + root_len + 1;
+    if (*rest == '\0' || strchr(rest, '/'))
+        return false;
+    name = rest;
+    return true;
+}
+
+//调用方持有m_lock,命中时增加引用
+cached_file *file_cache::find(const string &name, bool gzip)
+{
+    unordered_map<string, cached_file *>::iterator it;
+    //压缩版本常驻内存且总有addr
+    if (gzip && (it = m_gzip.find(name)) != m_gzip.end())
+    {
+        ++it->second->refs;
+        return it->second;
+    }
+    it = m_files.find(name);
+    if (it == m_files.end())
+        return NULL;
+    cached_file *file = it->second;
+    ++file->refs;
+    m_lru.splice(m_lru.begin(), m_lru, file->lru);
+    return file;
+}
+
+cached_file *file_cache::lookup(const char *path, bool need_map, bool gzip)
+{
+    string name;
+    if (!cache_name(path, name))
+        return NULL;
+
+    m_lock.lock();
+    cached_file *file = find(name, gzip);
+    m_lock.unlock();
+    //建立映射要留给工作线程
+    if (file && need_map && !file->addr)
+    {
+        release(file);
+        return NULL;
+    }
+    return file;
+}
+
+cached_file *file_cache::acquire(const char *path, bool need_map, bool gzip)
+{
+    string name;
+    if (!cache_name(path, name))
+        return NULL;
+
+    m_lock.lock();
+    cached_file *file = find(name, gzip);
+    if (file)
+    {
+        if (need_map && !file->addr)
+        {
+            void *addr = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+            if (addr != MAP_FAILED)
+                file->addr = (char *)addr;
+        }
+        m_lock.unlock();
+        if (need_map && !file->addr)
+        {
+            release(file);
+            return NULL;
+        }
+        return file;
+    }
+    unsigned long long generation = m_generation;
+    m_lock.unlock();
+
+    //未命中时在锁外打开文件,插入前确认期间没有失效事件,否则这份结果可能已经过期
+    file = load(name, path, need_map);
+    if (!file)
+        return NULL;
+
+    m_lock.lock();
+    if (generation != m_generation || !enabled())
+    {
+        m_lock.unlock();
+        return file;
+    }
+    unordered_map<string, cached_file *>::iterator it = m_files.find(name);
+    if (it != m_files.end())
+    {
+        //另一个线程抢先插入了,用已有的那份
+        cached_file *exist = it->second;
+        ++exist->refs;
+        m_lru.splice(m_lru.begin(), m_lru, exist->lru);
+        if (need_map && !exist->addr)
+        {
+            exist->addr = file->addr.load();
+            file->addr = NULL;
+        }
+        m_lock.unlock();
+        release(file);
+        return exist;
+    }
+
+    ++file->refs;
+    m_files[name] = file;
+    m_lru.push_front(file);
+    file->lru = m_lru.begin();
+    m_bytes += file->st.st_size;
+    while (m_bytes > m_max_bytes && m_lru.back() != file)
+        evict(m_lru.back());
+    m_lock.unlock();
+    return file;
+}
+
+void file_cache::release(cached_file *file)
+{
+    if (--file->refs > 0)
+        return;
+    if (file->addr)
+        munmap(file->addr, file->st.st_size);
+    if (file->fd >= 0)
+        close(file->fd);
+    delete file;
+}
+
+//打开文件并生成缓存项,引用计数为1(调用方持有),尚未放入缓存
+cached_file *file_cache::load(const string &name, const char *path, bool need_map)
+{
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH))
+        return NULL;
+    if (0 == st.st_size || (size_t)st.st_size > m_max_bytes)
+        return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    char *addr = NULL;
+    if (need_map || (size_t)st.st_size <= MAP_SMALL)
+    {
+        void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            return NULL;
+        }
+        addr = (char *)p;
+    }
+
+    cached_file *file = new cached_file;
+    file->name = name;
+    file->fd = fd;
+    file->st = st;
+    file->addr = addr;
+    file->refs = 1;
+    build_headers(file, st, false);
+    return file;
+}
+
+//生成校验器和200、304响应头,格式与http_conn::process_write逐项拼出的一致
+//st为原文件的元数据;可能有压缩版本的文件要告诉中间缓存按Accept-Encoding区分
+void file_cache::build_headers(cached_file *file, const struct stat &st, bool gzip)
+{
+    make_etag(st, gzip, file->etag, sizeof(file->etag));
+    http_date(st.st_mtime, file->last_modified, sizeof(file->last_modified));
+    file->meta_len = snprintf(file->meta, sizeof(file->meta), "ETag:%s\r\nLast-Modified:%s\r\nCache-Control:%s\r\n%s",
+                              file->etag, file->last_modified, cache_control(file->name.c_str()),
+                              gzip || compressible(file->name) ? "Vary:Accept-Encoding\r\n" : "");
+    for (int i = 0; i < 2; ++i)
+    {
+        const char *linger = i ? "keep-alive" : "close";
+        file->header_len[i] = snprintf(file->header[i], sizeof(file->header[i]),
+                                       "HTTP/1.1 200 OK\r\nContent-Length:%lld\r\n%s%sConnection:%s\r\n\r\n",
+                                       (long long)file->st.st_size,
+                                       gzip ? "Content-Encoding:gzip\r\n" : "Accept-Ranges:bytes\r\n", file->meta, linger);
+        file->not_modified_len[i] = snprintf(file->not_modified[i], sizeof(file->not_modified[i]),
+                                             "HTTP/1.1 304 Not Modified\r\n%sConnection:%s\r\n\r\n", file->meta, linger);
+    }
+}
+
+int file_cache::make_etag(const struct stat &st, bool gzip, char *buf, int size)
+{
+    unsigned long long mtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    return snprintf(buf, size, "\"%llx-%llx-%llx%s\"", (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+                    mtime, gzip ? "-gz" : "");
+}
+
+int file_cache::http_date(time_t t, char *buf, int size)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+//图片、视频和字体换了内容一般也换文件名,缓存一天;样式和脚本缓存一小时;其余每次都带校验器重新验证
+const char *file_cache::cache_control(const char *name)
+{
+    static const struct
+    {
+        const char *ext;
+        const char *policy;
+    } policies[] = {
+        {".png", "public, max-age=86400"}, {".jpg", "public, max-age=86400"}, {".jpeg", "public, max-age=86400"},
+        {".gif", "public, max-age=86400"}, {".ico", "public, max-age=86400"}, {".svg", "public, max-age=86400"},
+        {".webp", "public, max-age=86400"}, {".mp4", "public, max-age=86400"}, {".webm", "public, max-age=86400"},
+        {".woff", "public, max-age=86400"}, {".woff2", "public, max-age=86400"},
+        {".css", "public, max-age=3600"}, {".js", "public, max-age=3600"},
+    };
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i)
+    {
+        size_t len = strlen(policies[i].ext);
+        if (name_len > len && 0 == strcasecmp(name + name_len - len, policies[i].ext))
+            return policies[i].policy;
+    }
+    return "no-cache";
+}
+
+//值得压缩的文本类文件,图片和视频本身已经压缩过
+bool file_cache::compressible(const string &name)
+{
+    static const char *exts[] = {".html", ".htm", ".css", ".js", ".json", ".txt", ".xml", ".svg", ".ico"};
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i)
+    {
+        size_t len = strlen(exts[i]);
+        if (name.size() > len && 0 == strcasecmp(name.c_str() + name.size() - len, exts[i]))
+            return true;
+    }
+    return false;
+}
+
+//生成name的gzip版本:根目录下有不比原文件旧的name.gz时直接读入,否则在内存里压缩
+//内容放在匿名映射里,和其他缓存项一样在最后一个引用释放时munmap;压缩后不变小的返回NULL
+cached_file *file_cache::build_gzip(const string &name)
+{
+    string path = m_root + "/" + name;
+    struct stat st;
+    if (!compressible(name) || stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH))
+        return NULL;
+    if (0 == st.st_size || (size_t)st.st_size > m_max_bytes)
+        return NULL;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    char *src = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED)
+        return NULL;
+
+    size_t cap = compressBound(st.st_size) + 32;
+    char *out = (char *)mmap(0, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (out == MAP_FAILED)
+    {
+        munmap(src, st.st_size);
+        return NULL;
+    }
+
+    size_t len = 0;
+    struct stat gz_st;
+    string gz_path = path + ".gz";
+    int gz_fd = -1;
+    if (stat(gz_path.c_str(), &gz_st) == 0 && S_ISREG(gz_st.st_mode) && gz_st.st_mtime >= st.st_mtime &&
+        (size_t)gz_st.st_size <= cap && (gz_fd = open(gz_path.c_str(), O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+        ssize_t n;
+        while (len < (size_t)gz_st.st_size && (n = read(gz_fd, out + len, gz_st.st_size - len)) > 0)
+            len += n;
+        close(gz_fd);
+        if (len != (size_t)gz_st.st_size)
+            len = 0;
+    }
+    if (0 == len)
+    {
+        //windowBits加16输出gzip格式
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            zs.next_in = (Bytef *)src;
+            zs.avail_in = st.st_size;
+            zs.next_out = (Bytef *)out;
+            zs.avail_out = cap;
+            if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+                len = zs.total_out;
+            deflateEnd(&zs);
+        }
+    }
+    munmap(src, st.st_size);
+
+    if (0 == len || len >= (size_t)st.st_size)
+    {
+        munmap(out, cap);
+        return NULL;
+    }
+    //多出的整页还给系统,剩下的长度与st_size一致,release时按它munmap
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t keep = (len + page - 1) & ~(page - 1);
+    if (keep < cap)
+        munmap(out + keep, cap - keep);
+    mprotect(out, keep, PROT_READ);
+
+    cached_file *file = new cached_file;
+    file->name = name;
+    file->fd = -1;
+    file->st = st;
+    file->st.st_size = len;
+    file->addr = out;
+    file->refs = 1;
+    build_headers(file, st, true);
+    return file;
+}
+
+//丢掉name的压缩版本,rebuild时重新生成;只在启动和监视线程里调用
+void file_cache::update_gzip(const string &name, bool rebuild)
+{
+    cached_file *file = rebuild ? build_gzip(name) : NULL;
+
+    m_lock.lock();
+    unordered_map<string, cached_file *>::iterator it = m_gzip.find(name);
+    if (it != m_gzip.end())
+    {
+        m_gzip_bytes -= it->second->st.st_size;
+        release(it->second);
+        m_gzip.erase(it);
+    }
+    if (file)
+    {
+        m_gzip[name] = file;
+        m_gzip_bytes += file->st.st_size;
+    }
+    m_lock.unlock();
+}
+
+void file_cache::build_all_gzip()
+{
+    DIR *dir = opendir(m_root.c_str());
+    if (!dir)
+        return;
+    while (struct dirent *ent = readdir(dir))
+    {
+        string name(ent->d_name);
+        if (compressible(name))
+            update_gzip(name, true);
+    }
+    closedir(dir);
+
+    m_lock.lock();
+    LOG_INFO("file cache: %d gzip variants, %zu bytes", (int)m_gzip.size(), m_gzip_bytes);
+    m_lock.unlock();
+}
+
+//移出缓存并归还缓存持有的引用,调用方需持有m_lock
+void file_cache::evict(cached_file *file)
+{
+    m_files.erase(file->name);
+    m_lru.erase(file->lru);
+    m_bytes -= file->st.st_size;
+    release(file);
+}
+
+void file_cache::invalidate(const char *name)
+{
+    m_lock.lock();
+    ++m_generation;
+    unordered_map<string, cached_file *>::iterator it = m_files.find(name);
+    if (it != m_files.end())
+    {
+        LOG_INFO("file cache invalidate %s", name);
+        evict(it->second);
+    }
+    m_lock.unlock();
+}
+
+void file_cache::invalidate_all()
+{
+    m_lock.lock();
+    ++m_generation;
+    while (!m_lru.empty())
+        evict(m_lru.back());
+    m_lock.unlock();
+}
@@ -0,0 +1,110 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "../lock/locker.h"
+
+using namespace std;
+
+//缓存中的一个文件,fd和映射在最后一个引用释放时才关闭
+struct cached_file
+{
+    string name;                    //相对网站根目录的文件名
+    int fd;                         //gzip版本只在内存里,为-1
+    struct stat st;
+    std::atomic<char *> addr;       //长期映射,小文件载入时即建立,其余第一次有连接按mmap方式发送时才建立
+                                    //只在m_lock内从NULL写一次,命中的连接在锁外读,所以是原子的
+                                    //gzip版本为压缩后内容,st.st_size为压缩后的长度
+    char etag[64];                  //带引号的强ETag
+    char last_modified[32];
+    //ETag、Last-Modified、Cache-Control和Vary,200、206和304响应共用
+    char meta[256];
+    int meta_len;
+    //预先生成的200和304响应头,下标为是否keep-alive,发送时直接放进iovec
+    char header[2][384];
+    int header_len[2];
+    char not_modified[2][320];
+    int not_modified_len[2];
+    std::atomic<int> refs;          //缓存本身持有一个引用
+    list<cached_file *>::iterator lru;
+};
+
+//网站根目录下静态文件的打开文件和元数据缓存,按字节数上限做LRU淘汰
+//inotify监视根目录,文件被修改、删除或替换时把对应项移出缓存
+//文本类文件启动时预先压缩一份gzip版本常驻内存,文件变化时由监视线程重新压缩,请求路径上从不压缩
+class file_cache
+{
+public:
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    //不超过这个大小的文件载入时就建立映射,sendfile方式下也直接writev
+    static const size_t MAP_SMALL = 16 * 1024;
+
+    //max_bytes为0时不启用缓存
+    bool init(const char *root, size_t max_bytes, int close_log);
+
+    //命中时返回并增加引用,不产生任何系统调用;need_map时保证addr可用
+    //gzip为客户端接受gzip编码,文件有gzip版本时返回压缩版本
+    //文件不存在、不可读、是目录、超出上限或不在根目录下时返回NULL,由调用方走原来的stat/open流程
+    cached_file *acquire(const char *path, bool need_map, bool gzip = false);
+    //只查已缓存的项,未命中或需要映射但还没建立时返回NULL,可以在事件循环上调用
+    cached_file *lookup(const char *path, bool need_map, bool gzip = false);
+    void release(cached_file *file);
+
+    bool enabled() { return m_enabled; }
+
+    //强ETag:inode、大小和纳秒级的修改时间,带引号;gzip版本加后缀,和原文件区分
+    static int make_etag(const struct stat &st, bool gzip, char *buf, int size);
+    //Last-Modified使用的HTTP日期
+    static int http_date(time_t t, char *buf, int size);
+    //按扩展名决定浏览器缓存多久,页面每次都要重新验证
+    static const char *cache_control(const char *name);
+
+private:
+    file_cache();
+    ~file_cache();
+
+    static void *watch_thread(void *arg);
+    void watch();
+    bool cache_name(const char *path, string &name);
+    cached_file *find(const string &name, bool gzip);
+    cached_file *load(const string &name, const char *path, bool need_map);
+    void evict(cached_file *file);
+    void invalidate(const char *name);
+    void invalidate_all();
+
+    static bool compressible(const string &name);
+    static void build_headers(cached_file *file, const struct stat &st, bool gzip);
+    cached_file *build_gzip(const string &name);
+    void update_gzip(const string &name, bool rebuild);
+    void build_all_gzip();
+
+private:
+    string m_root;
+    std::atomic<bool> m_enabled;
+    size_t m_max_bytes;
+    size_t m_bytes;                             //缓存中文件的总字节数
+    unordered_map<string, cached_file *> m_files;
+    list<cached_file *> m_lru;                  //表头为最近使用
+    unordered_map<string, cached_file *> m_gzip; //gzip版本,按原文件名索引,不参与LRU淘汰
+    size_t m_gzip_bytes;
+    unsigned long long m_generation;            //每次失效加一,未命中时据此丢弃打开期间已过期的结果
+    locker m_lock;
+
+    int m_inotify_fd;
+    pthread_t m_tid;
+    int m_close_log;
+};
+
+#endif
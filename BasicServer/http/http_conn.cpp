@@ -1,4 +1,5 @@
 #include "http_conn.h"
+#include "http_scan.h"
 
 #include <mysql/mysql.h>
 #include <fstream>
@@ -13,12 +14,18 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *partial_206_title = "Partial Content";
+const char *not_modified_304_title = "Not Modified";
+const char *error_416_title = "Range Not Satisfiable";
+//multipart/byteranges各段之间的分隔串
+const char *range_boundary = "5b1d3c7e9a0f2486";
 
+//注册时数据库插入和索引插入一起做,同名注册不会都写进数据库
 locker m_lock;
-map<string, string> users;
 
-void http_conn::initmysql_result(connection_pool *connPool)
+void http_conn::initmysql_result(connection_pool *connPool, int close_log)
 {
+    int m_close_log = close_log; //LOG_*宏使用
     //先从连接池中取一个连接
     MYSQL *mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
@@ -38,12 +45,11 @@ void http_conn::initmysql_result(connection_pool *connPool)
     //返回所有字段结构的数组
     MYSQL_FIELD *fields = mysql_fetch_fields(result);
 
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
+    //从结果集中获取下一行，将对应的用户名和密码，存入索引中
+    user_index *users = user_index::get_instance();
     while (MYSQL_ROW row = mysql_fetch_row(result))
     {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+        users->insert(row[0], row[1]);
     }
 }
 
@@ -94,50 +100,133 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
 
-//关闭连接，关闭一个连接，客户总量减一
-void http_conn::close_conn(bool real_close)
+//空闲连接只占一个连接对象(约300字节);缓冲区块约4KB,个数随同时处理的请求数增长
+slab http_conn::m_conn_slab(sizeof(http_conn), 1024);
+slab http_conn::m_io_slab(sizeof(http_conn::http_io), 256);
+
+http_conn *http_conn::create()
 {
-    if (real_close && (m_sockfd != -1))
-    {
-        printf("close %d\n", m_sockfd);
-        removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        m_user_count--;
-    }
+    void *p = m_conn_slab.alloc();
+    if (!p)
+        return NULL;
+    return new (p) http_conn();
+}
+
+//连接关闭后由事件循环调用,归还文件、缓冲区块和连接对象
+void http_conn::destroy(http_conn *conn)
+{
+    if (!conn)
+        return;
+    conn->release_file();
+    conn->release_io();
+#ifdef HTTP_COROUTINE
+    //连接上可能还挂着等待读的协程
+    if (conn->m_read_waiter)
+        destroy_coroutine(conn->m_read_waiter);
+#endif
+    conn->~http_conn();
+    m_conn_slab.free(conn);
+}
+
+void http_conn::pool_usage(size_t &conns, size_t &ios, size_t &reserved)
+{
+    conns = m_conn_slab.in_use();
+    ios = m_io_slab.in_use();
+    reserved = m_conn_slab.reserved() + m_io_slab.reserved();
+}
+
+//开始读请求前取一块缓冲区,已持有时直接返回
+bool http_conn::acquire_io()
+{
+    if (m_io)
+        return true;
+    m_io = (http_io *)m_io_slab.alloc();
+    if (!m_io)
+        return false;
+    //map_file中strncpy不一定补'\0',最后一个字节始终保持为'\0'
+    m_io->real_file[FILENAME_LEN - 1] = '\0';
+    memset(m_io->header_index, 0, sizeof(m_io->header_index));
+    return true;
+}
+
+//读缓冲区中没有剩余字节时归还缓冲区,空闲的长连接只占连接对象本身
+void http_conn::release_io()
+{
+    if (!m_io)
+        return;
+    m_io_slab.free(m_io);
+    m_io = NULL;
+}
+
+//生成响应失败时关闭连接
+//fd和连接对象由事件循环统一回收:shutdown后重新注册读事件,循环收到EPOLLRDHUP后删除定时器并关闭
+//工作线程自己close的话,定时器还留在时间轮里,到期时会关掉已被复用的fd
+void http_conn::close_conn()
+{
+    LOG_INFO("close fd %d", m_sockfd);
+    shutdown(m_sockfd, SHUT_RDWR);
+    rearm(EPOLLIN);
 }
 
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
-                     int close_log, string user, string passwd, string sqlname)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, char *root, int TRIGMode,
+                     int close_log, bool sendfile)
 {
     m_sockfd = sockfd;
+    m_epollfd = epollfd;
     m_address = addr;
+    //对象从slab复用,成员里还是上一个连接的值,注册事件前先设置触发模式
+    m_TRIGMode = TRIGMode;
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
+    m_sendfile = sendfile;
 
-    strcpy(sql_user, user.c_str());
-    strcpy(sql_passwd, passwd.c_str());
-    strcpy(sql_name, sqlname.c_str());
+    notify_func = NULL;
+    notify_arg = NULL;
 
     init();
 }
 
 //初始化新接受的连接
-//check_state默认为分析请求行状态
+//缓冲区不清零:读写位置都从头开始,解析和格式化时会自己写'\0'
 void http_conn::init()
 {
     mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
+    m_read_idx = 0;
+    m_request_end = 0;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_keep_alive = false;
+    m_state = 0;
+    timer_flag = 0;
+    improv = 0;
+    lane_flag = 0;
+    start_request();
+}
+
+//从上一个请求的结尾开始解析下一个请求,check_state默认为分析请求行状态
+//上一个请求的字节已全部处理时读位置直接回到开头,否则剩下的流水线请求留在原处,需要时再前移
+void http_conn::start_request()
+{
+    if (m_request_end < m_read_idx && m_content_length > 0)
+        m_io->read_buf[m_request_end] = m_body_tail;
+    if (m_request_end == m_read_idx)
+    {
+        m_read_idx = 0;
+        m_request_end = 0;
+    }
+    m_request_start = m_request_end;
+    m_start_line = m_request_end;
+    m_checked_idx = m_request_end;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
@@ -145,46 +234,62 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_header_count = 0;
+    //刚建立的连接还没有缓冲区,取缓冲区时再清空
+    if (m_io)
+        memset(m_io->header_index, 0, sizeof(m_io->header_index));
     cgi = 0;
-    m_state = 0;
-    timer_flag = 0;
-    improv = 0;
+}
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+//当前请求还没读全时,把它已读到的部分移到缓冲区开头,给后续的读留出空间
+//已解析出的指针随之前移,请求头的位置相对请求起点记录,不用调整
+void http_conn::compact()
+{
+    int shift = m_request_start;
+    if (0 == shift)
+        return;
+    memmove(m_io->read_buf, m_io->read_buf + shift, m_read_idx - shift);
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_request_start = 0;
+    m_request_end = 0;
+    if (m_url)
+        m_url -= shift;
+    if (m_version)
+        m_version -= shift;
+    if (m_host)
+        m_host -= shift;
 }
 
 //从状态机，用于分析出一行内容
 //返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    //向量化扫描跳过普通字符,直接停在下一个\r或\n上
+    const char *eol = scan_eol(m_io->read_buf + m_checked_idx, m_io->read_buf + m_read_idx);
+    m_checked_idx = eol - m_io->read_buf;
+    if (m_checked_idx < m_read_idx)
     {
-        temp = m_read_buf[m_checked_idx];
+        char temp = m_io->read_buf[m_checked_idx];
         if (temp == '\r')
         {
             if ((m_checked_idx + 1) == m_read_idx)
                 return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
+            else if (m_io->read_buf[m_checked_idx + 1] == '\n')
             {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                m_io->read_buf[m_checked_idx++] = '\0';
+                m_io->read_buf[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
         }
         else if (temp == '\n')
         {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+            if (m_checked_idx > 1 && m_io->read_buf[m_checked_idx - 1] == '\r')
             {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                m_io->read_buf[m_checked_idx - 1] = '\0';
+                m_io->read_buf[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
@@ -197,7 +302,7 @@ http_conn::LINE_STATUS http_conn::parse_line()
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    if (m_read_idx >= READ_BUFFER_SIZE || !acquire_io())
     {
         return false;
     }
@@ -206,7 +311,7 @@ bool http_conn::read_once()
     //LT读取数据
     if (0 == m_TRIGMode)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_sockfd, m_io->read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
         m_read_idx += bytes_read;
 
         if (bytes_read <= 0)
@@ -217,11 +322,12 @@ bool http_conn::read_once()
         return true;
     }
     //ET读数据
+    //缓冲区满时先停下,剩下的流水线请求留在内核里,处理完重新注册读事件时还会再通知
     else
     {
-        while (true)
+        while (m_read_idx < READ_BUFFER_SIZE)
         {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            bytes_read = recv(m_sockfd, m_io->read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
             if (bytes_read == -1)
             {
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -241,8 +347,10 @@ bool http_conn::read_once()
 //解析http请求行，获得请求方法，目标url及http版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 {
-    m_url = strpbrk(text, " \t");
-    if (!m_url)
+    //parse_line已把行尾的\r\n改成\0\0,行尾就在m_checked_idx前两个字节
+    const char *end = m_io->read_buf + m_checked_idx - 2;
+    m_url = (char *)scan_blank(text, end);
+    if (m_url == end)
     {
         return BAD_REQUEST;
     }
@@ -258,8 +366,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     else
         return BAD_REQUEST;
     m_url += strspn(m_url, " \t");
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version)
+    m_version = (char *)scan_blank(m_url, end);
+    if (m_version >= end)
         return BAD_REQUEST;
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
@@ -279,9 +387,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
@@ -293,44 +398,119 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     {
         if (m_content_length != 0)
         {
+            //请求体加上结尾的'\0'必须能和请求头一起放进读缓冲区,否则永远读不全
+            if (m_content_length < 0 || m_checked_idx - m_request_start + m_content_length >= READ_BUFFER_SIZE)
+            {
+                m_linger = false;
+                return BAD_REQUEST;
+            }
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
+        m_request_end = m_checked_idx;
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+
+    //记录名字和值在读缓冲区中的位置,不拷贝;值去掉首尾空白
+    char *colon = strchr(text, ':');
+    if (!colon)
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
-        {
-            m_linger = true;
-        }
+        LOG_INFO("oop!unknow header: %s", text);
+        return NO_REQUEST;
     }
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+    char *end = m_io->read_buf + m_checked_idx - 2;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+
+    HEADER_NAME id = header_id(text, colon - text);
+    if (m_header_count < MAX_HEADERS)
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        header_field &field = m_io->headers[m_header_count++];
+        const char *start = m_io->read_buf + m_request_start;
+        field.name_off = text - start;
+        field.name_len = colon - text;
+        field.value_off = value - start;
+        field.value_len = end - value;
+        field.id = id;
+        if (id != HDR_UNKNOWN && 0 == m_io->header_index[id])
+            m_io->header_index[id] = m_header_count;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0)
+
+    switch (id)
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }
-    else
+    case HDR_CONNECTION:
     {
+        str_ref conn = {value, (int)(end - value)};
+        if (conn.equals_nocase("keep-alive"))
+            m_linger = true;
+        break;
+    }
+    case HDR_CONTENT_LENGTH:
+        m_content_length = atol(value);
+        break;
+    case HDR_HOST:
+        m_host = value;
+        break;
+    case HDR_UNKNOWN:
         LOG_INFO("oop!unknow header: %s", text);
+        break;
+    default:
+        break;
     }
     return NO_REQUEST;
 }
 
+bool http_conn::get_header(HEADER_NAME id, str_ref &value) const
+{
+    int i = m_io->header_index[id];
+    if (0 == i)
+        return false;
+    value = header_value_at(i - 1);
+    return true;
+}
+
+//不在分类表里的请求头按名字逐个比较
+bool http_conn::get_header(const char *name, str_ref &value) const
+{
+    for (int i = 0; i < m_header_count; ++i)
+    {
+        if (header_name_at(i).equals_nocase(name))
+        {
+            value = header_value_at(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+str_ref http_conn::header_name_at(int i) const
+{
+    str_ref ref = {m_io->read_buf + m_request_start + m_io->headers[i].name_off, m_io->headers[i].name_len};
+    return ref;
+}
+
+str_ref http_conn::header_value_at(int i) const
+{
+    str_ref ref = {m_io->read_buf + m_request_start + m_io->headers[i].value_off, m_io->headers[i].value_len};
+    return ref;
+}
+
 //判断http请求是否被完整读入
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
+        //请求体后面要写一个'\0',请求体正好顶到缓冲区末尾时先把请求移到开头
+        //parse_headers已保证整个请求加上'\0'放得下
+        if (m_checked_idx + m_content_length >= READ_BUFFER_SIZE)
+        {
+            compact();
+            text = m_io->read_buf + m_checked_idx;
+        }
+        m_request_end = m_checked_idx + m_content_length;
+        m_body_tail = text[m_content_length];
         text[m_content_length] = '\0';
         //POST请求中最后为输入的用户名和密码
         m_string = text;
@@ -345,7 +525,9 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
 
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
+    //请求体不按行解析,没读全时不能再用parse_line扫描,否则m_checked_idx会越过请求体的起点
+    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) ||
+           (m_check_state != CHECK_STATE_CONTENT && (line_status = parse_line()) == LINE_OK))
     {
         text = get_line();
         m_start_line = m_checked_idx;
@@ -366,7 +548,7 @@ http_conn::HTTP_CODE http_conn::process_read()
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
             {
-                return do_request();
+                return GET_REQUEST;
             }
             break;
         }
@@ -374,7 +556,7 @@ http_conn::HTTP_CODE http_conn::process_read()
         {
             ret = parse_content(text);
             if (ret == GET_REQUEST)
-                return do_request();
+                return GET_REQUEST;
             line_status = LINE_OPEN;
             break;
         }
@@ -382,209 +564,566 @@ http_conn::HTTP_CODE http_conn::process_read()
             return INTERNAL_ERROR;
         }
     }
+    compact();
     return NO_REQUEST;
 }
 
+//同步处理:路由、必要时写数据库、再映射要返回的文件
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');
-
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
-    }
+    if (route_request())
+        register_user();
+    return map_file();
+}
 
-    if (*(p + 1) == '0')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//按路由表决定返回的页面,登录直接查用户索引得到结果
+//返回true表示是新用户注册,还需要写数据库
+bool http_conn::route_request()
+{
+    str_ref path = {m_url, (int)strcspn(m_url, "?")};
+    m_route = find_route(path, m_method);
+    m_page = NULL;
+    if (!m_route)
+        return false;
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '1')
+    if (ROUTE_PAGE == m_route->kind)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        m_page = m_route->page;
+        return false;
     }
-    else if (*(p + 1) == '5')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '6')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    //将用户名和密码提取出来
+    char name[100], password[100];
+    parse_user(name, password);
 
-        free(m_url_real);
+    //如果是注册，先检测数据库中是否有重名的
+    //没有重名的，进行增加数据
+    if (ROUTE_REGISTER == m_route->kind)
+    {
+        if (!user_index::get_instance()->contains(name))
+            return true;
+        m_page = m_route->error_page;
     }
-    else if (*(p + 1) == '7')
+    //如果是登录，直接判断
+    else
+        m_page = user_index::get_instance()->verify(name, password) ? m_route->page : m_route->error_page;
+    return false;
+}
+
+//user=123&passwd=123
+void http_conn::parse_user(char *name, char *password)
+{
+    int i;
+    for (i = 5; m_string[i] != '&'; ++i)
+        name[i - 5] = m_string[i];
+    name[i - 5] = '\0';
+
+    int j = 0;
+    for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
+        password[j] = m_string[i];
+    password[j] = '\0';
+}
+
+//注册新用户,调用前需已取得数据库连接
+void http_conn::register_user()
+{
+    char name[100], password[100];
+    parse_user(name, password);
+
+    char *sql_insert = (char *)malloc(sizeof(char) * 200);
+    strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
+    strcat(sql_insert, "'");
+    strcat(sql_insert, name);
+    strcat(sql_insert, "', '");
+    strcat(sql_insert, password);
+    strcat(sql_insert, "')");
+
+    //route_request检查之后可能已有同名用户注册成功,加锁后再查一次;写库失败的不进索引
+    int res = 1;
+    m_lock.lock();
+    if (!user_index::get_instance()->contains(name))
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        res = mysql_query(mysql, sql_insert);
+        if (!res)
+            user_index::get_instance()->insert(name, password);
+    }
+    m_lock.unlock();
+    free(sql_insert);
 
-        free(m_url_real);
+    m_page = res ? m_route->error_page : m_route->page;
+}
+
+//Accept-Encoding中是否接受gzip:逗号分隔的编码,可带;q=权重,q为0表示不接受
+static bool accept_gzip(str_ref value)
+{
+    const char *p = value.data, *end = value.data + value.len;
+    while (p < end)
+    {
+        const char *next = (const char *)memchr(p, ',', end - p);
+        if (!next)
+            next = end;
+        while (p < next && (*p == ' ' || *p == '\t'))
+            ++p;
+        const char *param = (const char *)memchr(p, ';', next - p);
+        const char *name_end = param ? param : next;
+        while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+            --name_end;
+        str_ref coding = {p, (int)(name_end - p)};
+        if (coding.equals_nocase("gzip") || coding.equals_nocase("x-gzip") || coding.equals_nocase("*"))
+        {
+            //q=0、q=0.0、q=0.000都是拒绝
+            bool zero = false;
+            for (const char *q = param; q && q + 2 <= next; ++q)
+            {
+                if ((*q == 'q' || *q == 'Q') && q[1] == '=')
+                {
+                    const char *v = q + 2;
+                    zero = v < next && *v == '0';
+                    for (++v; zero && v < next && *v != ' ' && *v != ';'; ++v)
+                        zero = *v == '0' || *v == '.';
+                    break;
+                }
+            }
+            return !zero;
+        }
+        p = next + 1;
     }
+    return false;
+}
+
+//由路由决定的页面或url得到文件路径,并决定发送方式,返回是否带Range
+bool http_conn::prepare_file(str_ref &range, bool &need_map, bool &gzip)
+{
+    strcpy(m_io->real_file, doc_root);
+    int len = strlen(doc_root);
+    strncpy(m_io->real_file + len, m_page ? m_page : m_url, FILENAME_LEN - len - 1);
+
+    //Range按原文件的字节计算,带Range的请求不取压缩版本
+    //多段时各段之间要插入分隔头,只能从映射里取数据,sendfile方式下也要映射
+    m_range_count = 0;
+    str_ref encoding;
+    bool ranged = GET == m_method && get_header(HDR_RANGE, range);
+    need_map = !m_sendfile || (ranged && range.len > 0 && memchr(range.data, ',', range.len));
+    gzip = !ranged && get_header(HDR_ACCEPT_ENCODING, encoding) && accept_gzip(encoding);
+    return ranged;
+}
+
+//命中缓存时直接用缓存的fd或映射,不产生文件系统调用
+http_conn::HTTP_CODE http_conn::cached_request(bool ranged, str_ref range)
+{
+    m_io->file_stat = m_cached->st;
+    //校验器和客户端的副本一致时只回304,不引用文件内容
+    if (GET == m_method && not_modified(m_cached->etag, m_cached->last_modified, m_cached->st.st_mtime))
+        return NOT_MODIFIED;
+    if (ranged && range_current(m_cached->etag, m_cached->last_modified))
+        parse_range(range, m_io->file_stat.st_size);
+    //小文件缓存时已建立映射,sendfile方式下也直接writev,省一次系统调用且能和流水线上的其他响应合并
+    char *addr = m_cached->addr;
+    if (addr)
+        m_file_address = addr;
     else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    {
+        m_file_fd = m_cached->fd;
+        m_file_offset = 0;
+    }
+    return FILE_REQUEST;
+}
+
+//只查文件缓存,协程在事件循环上先试一次,命中时不用交给工作线程,未命中返回false
+bool http_conn::map_cached(HTTP_CODE &ret)
+{
+    str_ref range = {NULL, 0};
+    bool need_map, gzip;
+    bool ranged = prepare_file(range, need_map, gzip);
+    m_cached = file_cache::get_instance()->lookup(m_io->real_file, need_map, gzip);
+    if (!m_cached)
+        return false;
+    ret = cached_request(ranged, range);
+    return true;
+}
 
-    if (stat(m_real_file, &m_file_stat) < 0)
+//取路由决定的页面或url对应的文件,检查权限后映射到内存
+http_conn::HTTP_CODE http_conn::map_file()
+{
+    str_ref range = {NULL, 0};
+    bool need_map, gzip;
+    bool ranged = prepare_file(range, need_map, gzip);
+
+    //客户端接受gzip时优先取预先压缩的版本
+    m_cached = file_cache::get_instance()->acquire(m_io->real_file, need_map, gzip);
+    if (m_cached)
+        return cached_request(ranged, range);
+
+    if (stat(m_io->real_file, &m_io->file_stat) < 0)
         return NO_RESOURCE;
 
-    if (!(m_file_stat.st_mode & S_IROTH))
+    if (!(m_io->file_stat.st_mode & S_IROTH))
         return FORBIDDEN_REQUEST;
 
-    if (S_ISDIR(m_file_stat.st_mode))
+    if (S_ISDIR(m_io->file_stat.st_mode))
         return BAD_REQUEST;
 
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //空文件不需要打开,process_write直接回一个空页面
+    if (0 == m_io->file_stat.st_size)
+        return FILE_REQUEST;
+    if (GET == m_method)
+    {
+        char etag[64], last_modified[32];
+        file_cache::make_etag(m_io->file_stat, false, etag, sizeof(etag));
+        file_cache::http_date(m_io->file_stat.st_mtime, last_modified, sizeof(last_modified));
+        if (not_modified(etag, last_modified, m_io->file_stat.st_mtime))
+            return NOT_MODIFIED;
+        if (ranged && range_current(etag, last_modified))
+            parse_range(range, m_io->file_stat.st_size);
+    }
+    if (m_range_count < 0)
+        return FILE_REQUEST;
+
+    int fd = open(m_io->real_file, O_RDONLY);
+    if (fd < 0)
+        return NO_RESOURCE;
+
+    //sendfile方式保留fd,由内核直接从页缓存发送,不用映射和拷贝到用户态
+    if (!need_map)
+    {
+        m_file_fd = fd;
+        m_file_offset = 0;
+        return FILE_REQUEST;
+    }
+    m_file_address = (char *)mmap(0, m_io->file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
 }
-void http_conn::unmap()
+
+//If-None-Match优先,其中任一ETag按弱比较相同或为*时未修改;没有时看If-Modified-Since
+//浏览器一般原样带回Last-Modified,相同时不用解析日期
+bool http_conn::not_modified(const char *etag, const char *last_modified, time_t mtime)
 {
-    if (m_file_address)
+    str_ref value;
+    if (get_header(HDR_IF_NONE_MATCH, value))
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        int etag_len = strlen(etag);
+        const char *p = value.data, *end = value.data + value.len;
+        while (p < end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+                ++p;
+            if (p < end && *p == '*')
+                return true;
+            if (end - p > 2 && p[0] == 'W' && p[1] == '/')
+                p += 2;
+            const char *q = p;
+            while (q < end && *q != ',' && *q != ' ' && *q != '\t')
+                ++q;
+            if (q - p == etag_len && 0 == memcmp(p, etag, etag_len))
+                return true;
+            p = q;
+        }
+        return false;
     }
+    if (!get_header(HDR_IF_MODIFIED_SINCE, value))
+        return false;
+    if (value.equals(last_modified))
+        return true;
+
+    char date[64];
+    struct tm tm;
+    if (value.len >= (int)sizeof(date))
+        return false;
+    memcpy(date, value.data, value.len);
+    date[value.len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    const char *rest = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return rest && '\0' == *rest && mtime <= timegm(&tm);
 }
-bool http_conn::write()
-{
-    int temp = 0;
 
-    if (bytes_to_send == 0)
-    {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
+//If-Range只接受强校验器:和当前ETag或Last-Modified完全相同时按Range返回,否则返回整个文件
+bool http_conn::range_current(const char *etag, const char *last_modified)
+{
+    str_ref value;
+    if (!get_header(HDR_IF_RANGE, value))
         return true;
-    }
+    return value.equals(etag) || value.equals(last_modified);
+}
 
-    while (1)
+//解析Range: bytes=first-last, first-, -suffix,逗号分隔的多段
+//语法错误、段数过多时忽略Range返回整个文件;各段都超出文件末尾时为416
+//重叠或相接的段合并,按起始位置排序
+void http_conn::parse_range(str_ref value, off_t size)
+{
+    m_range_count = 0;
+    if (size <= 0 || value.len < 6 || strncasecmp(value.data, "bytes=", 6) != 0)
+        return;
+
+    byte_range *ranges = m_io->ranges;
+    int count = 0;
+    const char *p = value.data + 6, *end = value.data + value.len;
+    while (p < end)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        const char *next = (const char *)memchr(p, ',', end - p);
+        if (!next)
+            next = end;
+        while (p < next && (*p == ' ' || *p == '\t'))
+            ++p;
+        const char *q = next;
+        while (q > p && (q[-1] == ' ' || q[-1] == '\t'))
+            --q;
+        if (p == q)
+        {
+            p = next + 1;
+            continue;
+        }
 
-        if (temp < 0)
+        off_t first = -1, last = -1;
+        const char *dash = (const char *)memchr(p, '-', q - p);
+        if (!dash || (dash == p && dash + 1 == q))
+            return;
+        for (const char *c = p; c < dash; ++c)
         {
-            if (errno == EAGAIN)
+            if (*c < '0' || *c > '9' || first > (off_t)1 << 50)
+                return;
+            first = (first < 0 ? 0 : first * 10) + (*c - '0');
+        }
+        for (const char *c = dash + 1; c < q; ++c)
+        {
+            if (*c < '0' || *c > '9' || last > (off_t)1 << 50)
+                return;
+            last = (last < 0 ? 0 : last * 10) + (*c - '0');
+        }
+        if (first >= 0 && last >= 0 && last < first)
+            return;
+
+        //-suffix为最后suffix个字节
+        if (first < 0)
+        {
+            if (0 == last)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-                return true;
+                p = next + 1;
+                continue;
             }
-            unmap();
-            return false;
+            first = last < size ? size - last : 0;
+            last = size - 1;
         }
-
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
+        else if (first >= size)
+        {
+            p = next + 1;
+            continue;
+        }
+        else if (last < 0 || last >= size)
+            last = size - 1;
+
+        //按起始位置插入,和前后重叠或相接的段合并
+        int i = count;
+        while (i > 0 && ranges[i - 1].first > first)
+            --i;
+        if (i > 0 && ranges[i - 1].last + 1 >= first)
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            --i;
+            if (last > ranges[i].last)
+                ranges[i].last = last;
         }
         else
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            if (count == MAX_RANGES)
+                return;
+            memmove(ranges + i + 1, ranges + i, (count - i) * sizeof(byte_range));
+            ranges[i].first = first;
+            ranges[i].last = last;
+            ++count;
         }
-
-        if (bytes_to_send <= 0)
+        while (i + 1 < count && ranges[i].last + 1 >= ranges[i + 1].first)
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            if (ranges[i + 1].last > ranges[i].last)
+                ranges[i].last = ranges[i + 1].last;
+            memmove(ranges + i + 1, ranges + i + 2, (count - i - 2) * sizeof(byte_range));
+            --count;
+        }
+        p = next + 1;
+    }
+    m_range_count = count ? count : -1;
+}
+
+//释放本批响应的文件:归还缓存引用,解除映射或关闭sendfile使用的fd并取消TCP_CORK
+void http_conn::release_file()
+{
+    for (int i = 0; i < m_batch_count; ++i)
+        file_cache::get_instance()->release(m_io->batch_files[i]);
+    m_batch_count = 0;
+
+    bool corked = m_file_fd >= 0;
+    if (m_cached)
+    {
+        //fd和映射归缓存所有,只归还引用
+        file_cache::get_instance()->release(m_cached);
+        m_cached = NULL;
+    }
+    else
+    {
+        if (m_file_address)
+            munmap(m_file_address, m_io->file_stat.st_size);
+        if (m_file_fd >= 0)
+            close(m_file_fd);
+    }
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_range_count = 0;
+    if (corked)
+        cork(false);
+}
 
-            if (m_linger)
+//TCP_CORK打开时内核攒满一个MSS再发,响应头和文件开头合并成一个包;关闭时发出剩余数据
+void http_conn::cork(bool on)
+{
+    int val = on ? 1 : 0;
+    setsockopt(m_sockfd, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+}
+//向待发送的iovec追加一段,与上一段在内存中相连时直接合并
+void http_conn::add_iov(char *base, int len)
+{
+    if (len <= 0)
+        return;
+    bytes_to_send += len;
+    if (m_iv_count > 0 && (char *)m_io->iv[m_iv_count - 1].iov_base + m_io->iv[m_iv_count - 1].iov_len == base)
+    {
+        m_io->iv[m_iv_count - 1].iov_len += len;
+        return;
+    }
+    m_io->iv[m_iv_count].iov_base = base;
+    m_io->iv[m_iv_count].iov_len = len;
+    ++m_iv_count;
+}
+
+//发送了bytes字节后,调整iovec指向剩余待发送的数据
+//响应头可能在写缓冲区里,也可能是缓存里预先生成的,按iovec本身推进
+void http_conn::update_iov(int bytes)
+{
+    bytes_have_send += bytes;
+    bytes_to_send -= bytes;
+    for (int i = 0; i < m_iv_count && bytes > 0; ++i)
+    {
+        int len = bytes < (int)m_io->iv[i].iov_len ? bytes : (int)m_io->iv[i].iov_len;
+        m_io->iv[i].iov_base = (char *)m_io->iv[i].iov_base + len;
+        m_io->iv[i].iov_len -= len;
+        bytes -= len;
+    }
+}
+
+//通知所属事件循环下一步关注的事件
+void http_conn::rearm(int ev)
+{
+    if (notify_func)
+        notify_func(notify_arg, this, ev);
+    else
+        modfd(m_epollfd, m_sockfd, ev, m_TRIGMode);
+}
+
+//一批响应全部发出:释放文件并清空发送状态,返回false表示需要关闭连接
+bool http_conn::finish_write()
+{
+    release_file();
+    m_write_idx = 0;
+    m_iv_count = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    if (0 == m_read_idx)
+        release_io();
+    return m_keep_alive;
+}
+
+bool http_conn::write()
+{
+    int temp = 0;
+
+    //sendfile方式下响应头和文件分两次系统调用发送,先cork住避免头部单独成包
+    if (m_file_fd >= 0 && 0 == bytes_have_send)
+        cork(true);
+
+    while (bytes_to_send > 0)
+    {
+        //sendfile的响应总在一批的最后,iovec全部发完后文件部分直接由sendfile发送,m_file_offset由内核推进
+        if (m_file_fd >= 0 && 0 == m_io->iv[m_iv_count - 1].iov_len)
+            temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, bytes_to_send);
+        else
+            temp = writev(m_sockfd, m_io->iv, m_iv_count);
+
+        if (temp < 0)
+        {
+            if (errno == EAGAIN)
             {
-                init();
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
                 return true;
             }
-            else
-            {
-                return false;
-            }
+            release_file();
+            return false;
         }
+
+        update_iov(temp);
     }
+
+    if (!finish_write())
+        return false;
+    //流水线上的下一个请求已经在读缓冲区里时由调用方直接处理,此时不能再注册读事件
+    if (!buffered())
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+    return true;
+}
+//只看请求行的方法:GET只读静态文件,其余(登录、注册的POST)可能访问数据库
+//请求行还没读全时按数据库请求处理,宁可占用数据库线程也不能让静态线程碰数据库
+http_conn::REQUEST_LANE http_conn::request_lane()
+{
+    if (m_read_idx - m_request_start >= 4 && 0 == strncasecmp(m_io->read_buf + m_request_start, "GET ", 4))
+        return STATIC_LANE;
+    return DB_LANE;
 }
+
+//io_uring后端:读缓冲区剩余空间,len为0表示缓冲区已满或取不到缓冲区
+//recv提交后内核随时可能写入,所以等待数据期间一直持有缓冲区
+char *http_conn::read_space(int &len)
+{
+    len = 0;
+    if (!acquire_io())
+        return NULL;
+    len = READ_BUFFER_SIZE - m_read_idx;
+    return m_io->read_buf + m_read_idx;
+}
+
+void http_conn::read_done(int bytes)
+{
+    m_read_idx += bytes;
+}
+
+//io_uring后端:待发送的iovec,返回0表示没有数据要发
+int http_conn::write_iov(struct iovec *&iv)
+{
+    if (bytes_to_send <= 0)
+        return 0;
+    iv = m_io->iv;
+    return m_iv_count;
+}
+
+//io_uring后端:返回1表示还有数据未发完,0表示发完且保持连接,-1表示需关闭连接(bytes<0为发送失败)
+int http_conn::write_done(int bytes)
+{
+    if (bytes < 0)
+    {
+        release_file();
+        return -1;
+    }
+
+    update_iov(bytes);
+    if (bytes_to_send > 0)
+        return 1;
+
+    return finish_write() ? 0 : -1;
+}
+
 bool http_conn::add_response(const char *format, ...)
 {
     if (m_write_idx >= WRITE_BUFFER_SIZE)
         return false;
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+    int len = vsnprintf(m_io->write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
     if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
     {
         va_end(arg_list);
@@ -593,7 +1132,7 @@ bool http_conn::add_response(const char *format, ...)
     m_write_idx += len;
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
+    LOG_INFO("request:%s", m_io->write_buf);
 
     return true;
 }
@@ -618,6 +1157,17 @@ bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+//缓存的文件直接用预先生成的校验器
+bool http_conn::add_validators()
+{
+    if (m_cached)
+        return add_response("%s", m_cached->meta);
+    char etag[64], last_modified[32];
+    file_cache::make_etag(m_io->file_stat, false, etag, sizeof(etag));
+    file_cache::http_date(m_io->file_stat.st_mtime, last_modified, sizeof(last_modified));
+    return add_response("ETag:%s\r\nLast-Modified:%s\r\nCache-Control:%s\r\n", etag, last_modified,
+                        file_cache::cache_control(m_io->real_file));
+}
 bool http_conn::add_blank_line()
 {
     return add_response("%s", "\r\n");
@@ -626,8 +1176,10 @@ bool http_conn::add_content(const char *content)
 {
     return add_response("%s", content);
 }
+//生成一个响应并追加到待发送的iovec,流水线上前面请求的响应可能还在写缓冲区和iovec里
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    int start = m_write_idx;
     switch (ret)
     {
     case INTERNAL_ERROR:
@@ -654,18 +1206,55 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    case NOT_MODIFIED:
+    {
+        //304没有消息体,缓存的文件直接引用预先生成的响应头
+        if (m_cached)
+        {
+            add_iov(m_cached->not_modified[m_linger], m_cached->not_modified_len[m_linger]);
+            return true;
+        }
+        add_status_line(304, not_modified_304_title);
+        if (!add_validators() || !add_linger() || !add_blank_line())
+            return false;
+        break;
+    }
     case FILE_REQUEST:
     {
+        if (m_range_count < 0)
+        {
+            add_status_line(416, error_416_title);
+            add_response("Content-Range:bytes */%lld\r\n", (long long)m_io->file_stat.st_size);
+            add_headers(0);
+            break;
+        }
+        //写缓冲区放不下多段的分隔头时按整个文件返回
+        if (m_range_count > 0 && add_range_response(start))
+            return true;
+        //缓存的文件直接引用预先生成的响应头,不再逐项格式化
+        if (m_cached)
+        {
+            add_iov(m_cached->header[m_linger], m_cached->header_len[m_linger]);
+            if (m_file_address)
+                add_iov(m_file_address, m_io->file_stat.st_size);
+            else
+                bytes_to_send += m_io->file_stat.st_size;
+            return true;
+        }
         add_status_line(200, ok_200_title);
-        if (m_file_stat.st_size != 0)
-        {
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+        if (m_io->file_stat.st_size != 0)
+        {
+            add_response("Accept-Ranges:bytes\r\n");
+            add_validators();
+            add_headers(m_io->file_stat.st_size);
+            add_iov(m_io->write_buf + start, m_write_idx - start);
+            //sendfile方式下iovec里只有响应头,文件由write()接着发送
+            if (m_file_fd >= 0)
+            {
+                bytes_to_send += m_io->file_stat.st_size;
+                return true;
+            }
+            add_iov(m_file_address, m_io->file_stat.st_size);
             return true;
         }
         else
@@ -675,28 +1264,195 @@ bool http_conn::process_write(HTTP_CODE ret)
             if (!add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_iov(m_io->write_buf + start, m_write_idx - start);
+    return true;
+}
+
+//206响应:单段直接引用文件中的一段,sendfile方式下从段首发送;多段时每段前插入分隔头
+//多段的分隔头先写进写缓冲区算出总长度,响应头写在它们后面,iovec按响应的顺序引用
+bool http_conn::add_range_response(int start)
+{
+    long long size = m_io->file_stat.st_size;
+    byte_range *ranges = m_io->ranges;
+    if (1 == m_range_count)
+    {
+        off_t len = ranges[0].last - ranges[0].first + 1;
+        add_status_line(206, partial_206_title);
+        add_response("Content-Range:bytes %lld-%lld/%lld\r\n", (long long)ranges[0].first,
+                     (long long)ranges[0].last, size);
+        if (!add_validators() || !add_headers(len))
+        {
+            m_write_idx = start;
+            return false;
+        }
+        add_iov(m_io->write_buf + start, m_write_idx - start);
+        if (m_file_address)
+            add_iov(m_file_address + ranges[0].first, len);
+        else
+        {
+            m_file_offset = ranges[0].first;
+            bytes_to_send += len;
+        }
+        return true;
+    }
+
+    int part[MAX_RANGES + 1];
+    long long total = 0;
+    bool ok = true;
+    for (int i = 0; i < m_range_count && ok; ++i)
+    {
+        part[i] = m_write_idx;
+        ok = add_response("\r\n--%s\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n", range_boundary,
+                          (long long)ranges[i].first, (long long)ranges[i].last, size);
+        total += ranges[i].last - ranges[i].first + 1;
+    }
+    part[m_range_count] = m_write_idx;
+    ok = ok && add_response("\r\n--%s--\r\n", range_boundary);
+    int head = m_write_idx;
+    total += head - start;
+    ok = ok && add_status_line(206, partial_206_title) &&
+         add_response("Content-Type:multipart/byteranges; boundary=%s\r\n", range_boundary) && add_validators() &&
+         add_headers(total);
+    if (!ok || !m_file_address)
+    {
+        m_write_idx = start;
+        return false;
+    }
+
+    add_iov(m_io->write_buf + head, m_write_idx - head);
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        add_iov(m_io->write_buf + part[i], part[i + 1] - part[i]);
+        add_iov(m_file_address + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    add_iov(m_io->write_buf + part[m_range_count], head - part[m_range_count]);
     return true;
 }
-void http_conn::process()
+
+//一个响应已经生成,开始解析读缓冲区中的下一个请求
+//返回true表示可以接着处理下一个请求,把它的响应合并到同一次writev里
+bool http_conn::next_request()
+{
+    m_keep_alive = m_linger;
+    start_request();
+
+    //sendfile、独占的映射和多段Range响应只能放在一批的最后;批次、iovec或写缓冲区用完时先发出去
+    if (!m_keep_alive || m_file_fd >= 0 || (m_file_address && !m_cached) || m_range_count > 1)
+        return false;
+    if (m_batch_count + 1 >= MAX_PIPELINE || WRITE_BUFFER_SIZE - m_write_idx < RESPONSE_HEAD_MAX)
+        return false;
+    if (m_cached)
+    {
+        m_io->batch_files[m_batch_count++] = m_cached;
+        m_cached = NULL;
+        m_file_address = NULL;
+    }
+    return m_read_idx > m_request_start;
+}
+
+void http_conn::process(REQUEST_LANE lane)
 {
     HTTP_CODE read_ret = process_read();
     if (read_ret == NO_REQUEST)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        rearm(EPOLLIN);
         return;
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    while (true)
     {
-        close_conn();
+        if (read_ret == GET_REQUEST)
+            read_ret = do_request();
+        bool write_ret = process_write(read_ret);
+        if (!write_ret)
+        {
+            //事件循环接管时由其关闭连接,保证同一连接的请求都在循环线程里结束
+            if (notify_func)
+            {
+                notify_func(notify_arg, this, 0);
+                return;
+            }
+            close_conn();
+            return;
+        }
+        //静态线程不处理可能访问数据库的请求,留到这批发完后重新分派
+        if (!next_request() || (STATIC_LANE == lane && DB_LANE == request_lane()) || NO_REQUEST == (read_ret = process_read()))
+            break;
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    rearm(EPOLLOUT);
+}
+
+#ifdef HTTP_COROUTINE
+void readable_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    conn->m_read_waiter = h.address();
+    conn->rearm(EPOLLIN);
+}
+
+//事件循环读到数据后调用,恢复等待读的协程,没有则开始处理新请求
+void http_conn::run_coroutine()
+{
+    if (m_read_waiter)
+    {
+        void *co = m_read_waiter;
+        m_read_waiter = NULL;
+        resume_coroutine(co);
+        return;
+    }
+    process_async();
+}
+
+void http_conn::resume_coroutine(void *co)
+{
+    std::coroutine_handle<>::from_address(co).resume();
+}
+
+void http_conn::destroy_coroutine(void *co)
+{
+    std::coroutine_handle<>::from_address(co).destroy();
+}
+
+//process的协程版本,运行在事件循环线程上
+//解析和路由不阻塞,直接在循环里做;数据库和文件系统调用交给工作线程,期间循环继续服务其他连接
+request_coro http_conn::process_async()
+{
+    HTTP_CODE read_ret;
+    while (NO_REQUEST == (read_ret = process_read()))
+        co_await readable_awaiter{this};
+
+    //流水线上已经读全的请求接着处理,响应合并后一起发送
+    do
+    {
+        if (GET_REQUEST == read_ret)
+        {
+            if (route_request())
+            {
+                co_await offload(coro_ctx, m_sockfd, coro_gen, DB_LANE, [this] {
+                    {
+                        connectionRAII mysqlcon(&mysql, coro_ctx->conn_pool);
+                        register_user();
+                    }
+                    //连接已还回连接池,不能再留在连接对象上
+                    mysql = NULL;
+                });
+            }
+            //缓存命中时在循环里直接生成响应,只有要访问文件系统时才交给工作线程
+            if (!map_cached(read_ret))
+                read_ret = co_await offload(coro_ctx, m_sockfd, coro_gen, STATIC_LANE, [this] {
+                    return map_file();
+                });
+        }
+
+        if (!process_write(read_ret))
+        {
+            coro_ctx->close(coro_ctx->arg, m_sockfd);
+            co_return;
+        }
+    } while (next_request() && NO_REQUEST != (read_ret = process_read()));
+    rearm(EPOLLOUT);
 }
+#endif
@@ -19,12 +19,22 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
-#include <map>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/user_index.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../filecache/file_cache.h"
+#include "../mempool/slab.h"
+#include "http_header.h"
+#include "http_router.h"
+#ifdef HTTP_COROUTINE
+#include "http_coro.h"
+#endif
 
 class http_conn
 {
@@ -32,6 +42,10 @@ public:
     static const int FILENAME_LEN = 200;
     static const int READ_BUFFER_SIZE = 2048;
     static const int WRITE_BUFFER_SIZE = 1024;
+    static const int MAX_HEADERS = 32;
+    static const int MAX_PIPELINE = 8;          //一次writev最多合并的流水线响应数
+    static const int RESPONSE_HEAD_MAX = 384;   //一个响应在写缓冲区中最多占用的字节,剩余空间不足时不再合并
+    static const int MAX_RANGES = 6;            //multipart/byteranges最多的段数,更多时按整个文件返回
     enum METHOD
     {
         GET = 0,
@@ -58,6 +72,7 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        NOT_MODIFIED,
         INTERNAL_ERROR,
         CLOSED_CONNECTION
     };
@@ -67,37 +82,149 @@ public:
         LINE_BAD,
         LINE_OPEN
     };
+    //请求类别,事件循环读到请求行后据此选择线程池
+    enum REQUEST_LANE
+    {
+        STATIC_LANE = 0,
+        DB_LANE
+    };
 
-public:
-    http_conn() {}
+private:
+    //Range请求中的一段,闭区间
+    struct byte_range
+    {
+        off_t first;
+        off_t last;
+    };
+
+    //只在处理请求期间使用的缓冲区和解析结果,连接空闲时归还到共享池
+    struct http_io
+    {
+        char read_buf[READ_BUFFER_SIZE];
+        char write_buf[WRITE_BUFFER_SIZE];
+        char real_file[FILENAME_LEN];
+        header_field headers[MAX_HEADERS];      //本次请求的全部请求头,按出现顺序,位置相对m_request_start
+        unsigned char header_index[HDR_COUNT];  //每类请求头第一次出现在headers中的下标加一,0为没有
+        struct stat file_stat;
+        byte_range ranges[MAX_RANGES];
+        //流水线上每个响应最多两段;多段Range响应在一批的最后,再加响应头、每段的分隔头和数据、结尾分隔
+        struct iovec iv[2 * MAX_PIPELINE + 2 * MAX_RANGES + 2];
+        cached_file *batch_files[MAX_PIPELINE]; //同一批中前面几个响应引用的缓存文件,整批发完后归还
+    };
+
+    http_conn()
+    {
+        m_io = NULL;
+        m_file_address = NULL;
+        m_file_fd = -1;
+        m_cached = NULL;
+        m_range_count = 0;
+        m_batch_count = 0;
+        m_busy = 0;
+#ifdef HTTP_COROUTINE
+        coro_ctx = NULL;
+        m_read_waiter = NULL;
+#endif
+    }
     ~http_conn() {}
 
 public:
-    void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
-    void close_conn(bool real_close = true);
-    void process();
+    //连接对象在accept时从slab分配,关闭时归还;内存不足时返回NULL
+    static http_conn *create();
+    static void destroy(http_conn *conn);
+
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, char *, int, int, bool sendfile);
+    void close_conn();
+    //lane为执行的工作线程所在的线程池,静态线程不持有数据库连接
+    void process(REQUEST_LANE lane);
     bool read_once();
     bool write();
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    void initmysql_result(connection_pool *connPool);
-    int timer_flag;
-    int improv;
+    int get_sockfd() const { return m_sockfd; }
+    static void initmysql_result(connection_pool *connPool, int close_log);
+    //连接对象和缓冲区块的占用情况
+    static void pool_usage(size_t &conns, size_t &ios, size_t &reserved);
+    REQUEST_LANE request_lane();
+    //响应已全部发出而读缓冲区中还有未处理的字节(流水线上的下一个请求),应直接处理而不是等读事件
+    bool buffered() const { return 0 == bytes_to_send && m_read_idx > m_request_start; }
+
+    //按分类或名字取请求头,值直接指向读缓冲区,没有时返回false
+    bool get_header(HEADER_NAME id, str_ref &value) const;
+    bool get_header(const char *name, str_ref &value) const;
+    int header_count() const { return m_header_count; }
+    str_ref header_name_at(int i) const;
+    str_ref header_value_at(int i) const;
+
+    //io_uring后端使用,由事件循环提交收发请求,完成后回填结果
+    char *read_space(int &len);
+    void read_done(int bytes);
+    int write_iov(struct iovec *&iv);
+    int write_done(int bytes);
+
+    //reactor模式下工作线程完成读写后置位,事件循环忙等这两个标志,必须是原子的,否则等待循环可能被编译器优化掉
+    std::atomic<int> timer_flag;
+    std::atomic<int> improv;
+    //reactor模式下静态线程读到可能访问数据库的请求时置位,由事件循环转交数据库线程池
+    std::atomic<int> lane_flag;
+
+    //事件循环把连接交给工作线程前hold,工作线程最后一次访问连接后hand_back
+    //计数不为0时定时器不回收连接对象,可能同时有多次交接(如流水线请求),所以用计数而不是标志
+    void hold() { m_busy.fetch_add(1, std::memory_order_relaxed); }
+    void hand_back() { m_busy.fetch_sub(1, std::memory_order_release); }
+    bool busy() const { return m_busy.load(std::memory_order_acquire) != 0; }
 
+    //非空时process结束后不修改epoll,而是通知所属事件循环下一步要读(EPOLLIN)、写(EPOLLOUT)或关闭(0)
+    void (*notify_func)(void *arg, http_conn *conn, int ev);
+    void *notify_arg;
+
+#ifdef HTTP_COROUTINE
+    //非空时请求在所属事件循环上以协程处理,阻塞操作交给工作线程
+    coro_context *coro_ctx;
+    unsigned coro_gen;  //连接代数,协程交回事件循环时据此丢弃已关闭连接上的协程
+    void run_coroutine();
+    static void resume_coroutine(void *co);
+    static void destroy_coroutine(void *co);
+#endif
 
 private:
     void init();
+    void start_request();
+    bool next_request();
+    bool finish_write();
+    void compact();
+    bool acquire_io();
+    void release_io();
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
-    char *get_line() { return m_read_buf + m_start_line; };
+    bool route_request();
+    void parse_user(char *name, char *password);
+    void register_user();
+    HTTP_CODE map_file();
+    bool prepare_file(str_ref &range, bool &need_map, bool &gzip);
+    HTTP_CODE cached_request(bool ranged, str_ref range);
+    bool map_cached(HTTP_CODE &ret);
+    bool not_modified(const char *etag, const char *last_modified, time_t mtime);
+    bool range_current(const char *etag, const char *last_modified);
+    void parse_range(str_ref value, off_t size);
+    bool add_range_response(int start);
+#ifdef HTTP_COROUTINE
+    request_coro process_async();
+    friend struct readable_awaiter;
+#endif
+    char *get_line() { return m_io->read_buf + m_start_line; };
     LINE_STATUS parse_line();
-    void unmap();
+    void release_file();
+    void cork(bool on);
+    void add_iov(char *base, int len);
+    void update_iov(int bytes);
+    void rearm(int ev);
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
@@ -105,48 +232,60 @@ private:
     bool add_content_type();
     bool add_content_length(int content_length);
     bool add_linger();
+    bool add_validators();
     bool add_blank_line();
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    static std::atomic<int> m_user_count;
     MYSQL *mysql;
-    int m_state;  //读为0, 写为1
+    int m_state;  //读为0, 写为1, 2为读缓冲区中已有流水线请求(reactor)
 
 private:
     int m_sockfd;
+    int m_epollfd; //所属事件循环的epoll
     sockaddr_in m_address;
-    char m_read_buf[READ_BUFFER_SIZE];
+    http_io *m_io;          //正在处理请求时非空;读缓冲区中有未处理完的字节时一直持有
     int m_read_idx;
     int m_checked_idx;
     int m_start_line;
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    int m_request_start;    //当前请求在读缓冲区中的起点,前面的字节属于已处理的请求
+    int m_request_end;      //当前请求完整读入后的结尾,下一个流水线请求从这里开始
+    char m_body_tail;       //请求体结尾被'\0'覆盖前的字节,可能是下一个请求的第一个字节
     int m_write_idx;
     CHECK_STATE m_check_state;
     METHOD m_method;
-    char m_real_file[FILENAME_LEN];
     char *m_url;
     char *m_version;
     char *m_host;
+    int m_header_count;
     int m_content_length;
     bool m_linger;
-    char *m_file_address;
-    struct stat m_file_stat;
-    struct iovec m_iv[2];
+    bool m_keep_alive;      //当前这批响应中最后一个的m_linger,发完后据此决定是否关闭连接
+    char *m_file_address;   //mmap方式下文件的映射
+    int m_file_fd;          //sendfile方式下打开的文件
+    off_t m_file_offset;    //sendfile下一次发送的文件偏移,EAGAIN后从这里继续
+    bool m_sendfile;
+    cached_file *m_cached;  //来自文件缓存时非空,m_file_fd/m_file_address归缓存所有
+    int m_range_count;      //Range请求的段数,0为返回整个文件,-1为无法满足(416)
+    const route *m_route;   //本次请求命中的路由,没有为NULL
+    const char *m_page;     //路由决定返回的页面,为NULL时按url取文件
     int m_iv_count;
+    int m_batch_count;
+    std::atomic<int> m_busy;
     int cgi;        //是否启用的POST
     char *m_string; //存储请求头数据
     int bytes_to_send;
     int bytes_have_send;
     char *doc_root;
-
-    map<string, string> m_users;
     int m_TRIGMode;
     int m_close_log;
 
-    char sql_user[100];
-    char sql_passwd[100];
-    char sql_name[100];
+#ifdef HTTP_COROUTINE
+    void *m_read_waiter;    //等待更多请求数据而挂起的协程
+#endif
+
+    static slab m_conn_slab;
+    static slab m_io_slab;
 };
 
 #endif
@@ -0,0 +1,116 @@
+#ifndef HTTP_CORO_H
+#define HTTP_CORO_H
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "../threadpool/task.h"
+
+class http_conn;
+class connection_pool;
+
+//协程模式下事件循环提供给连接的运行环境,每个事件循环一份
+struct coro_context
+{
+    //把阻塞操作交给工作线程,lane为http_conn::REQUEST_LANE,队列满时返回false
+    //投递成功时连接被标记为忙,直到resume交回
+    bool (*offload)(void *arg, int sockfd, int lane, task &&job);
+    //工作线程做完后把协程交回事件循环,由循环线程恢复
+    //交回后连接对象可能被关闭回收,只按fd和代数找回连接
+    void (*resume)(void *arg, int sockfd, unsigned gen, void *co);
+    //生成响应失败时由事件循环关闭连接并删除定时器
+    void (*close)(void *arg, int sockfd);
+    //工作线程队列已满,回503并关闭连接
+    void (*shed)(void *arg, int sockfd);
+    void *arg;
+    connection_pool *conn_pool;
+};
+
+//请求处理协程,创建后立即执行,执行完自动释放协程帧
+//挂起只发生在等待可读和等待工作线程两处,由事件循环恢复
+struct request_coro
+{
+    struct promise_type
+    {
+        request_coro get_return_object() { return request_coro(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+//请求不完整时挂起,重新注册EPOLLIN,事件循环读到数据后恢复
+struct readable_awaiter
+{
+    http_conn *conn;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+};
+
+//把fn交给工作线程执行,期间事件循环继续处理其他连接,fn的返回值作为co_await的结果
+//投递失败(队列满)时不在事件循环上执行阻塞操作,回503关闭连接并销毁协程
+template <typename F>
+struct offload_awaiter
+{
+    typedef decltype(std::declval<F &>()()) result_type;
+
+    coro_context *ctx;
+    int sockfd;
+    unsigned gen;
+    int lane;
+    F fn;
+    completion<result_type> result;
+    std::coroutine_handle<> handle;
+
+    offload_awaiter(coro_context *c, int fd, unsigned g, int l, F f)
+        : ctx(c), sockfd(fd), gen(g), lane(l), fn(std::move(f)), result(), handle() {}
+
+    bool await_ready() const noexcept { return false; }
+
+    //工作线程写完结果后调用,把协程交回事件循环
+    static void done(void *arg)
+    {
+        offload_awaiter *self = static_cast<offload_awaiter *>(arg);
+        //交回后协程可能马上恢复并销毁本对象,先取出需要的字段
+        coro_context *ctx = self->ctx;
+        ctx->resume(ctx->arg, self->sockfd, self->gen, self->handle.address());
+    }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        offload_awaiter *self = this;
+        handle = h;
+        result.on_done(done, this);
+        bool posted = ctx->offload(ctx->arg, sockfd, lane, task([self] { self->result.run(self->fn); }));
+        if (!posted)
+        {
+            //本对象在协程帧里,销毁前先取出需要的字段
+            coro_context *c = ctx;
+            int fd = sockfd;
+            h.destroy();
+            c->shed(c->arg, fd);
+        }
+        return true;
+    }
+
+    result_type await_resume()
+    {
+        if constexpr (std::is_void<result_type>::value)
+            result.get();
+        else
+            return std::move(result.get());
+    }
+};
+
+template <typename F>
+offload_awaiter<F> offload(coro_context *ctx, int sockfd, unsigned gen, int lane, F fn)
+{
+    return offload_awaiter<F>(ctx, sockfd, gen, lane, std::move(fn));
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <string.h>
+#include <strings.h>
+
+//常见请求头,按名字分类后可以直接按下标取值
+enum HEADER_NAME
+{
+    HDR_UNKNOWN = 0,
+    HDR_HOST,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_USER_AGENT,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_COOKIE,
+    HDR_REFERER,
+    HDR_ORIGIN,
+    HDR_CACHE_CONTROL,
+    HDR_PRAGMA,
+    HDR_UPGRADE,
+    HDR_UPGRADE_INSECURE_REQUESTS,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MATCH,
+    HDR_IF_UNMODIFIED_SINCE,
+    HDR_IF_RANGE,
+    HDR_RANGE,
+    HDR_AUTHORIZATION,
+    HDR_TRANSFER_ENCODING,
+    HDR_EXPECT,
+    HDR_TE,
+    HDR_DNT,
+    HDR_SEC_FETCH_SITE,
+    HDR_SEC_FETCH_MODE,
+    HDR_SEC_FETCH_DEST,
+    HDR_SEC_FETCH_USER,
+    HDR_COUNT
+};
+
+//请求头名字的小写形式,下标与HEADER_NAME对应
+static constexpr const char *header_names[HDR_COUNT] = {
+    "",
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "user-agent",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "cookie",
+    "referer",
+    "origin",
+    "cache-control",
+    "pragma",
+    "upgrade",
+    "upgrade-insecure-requests",
+    "if-modified-since",
+    "if-none-match",
+    "if-match",
+    "if-unmodified-since",
+    "if-range",
+    "range",
+    "authorization",
+    "transfer-encoding",
+    "expect",
+    "te",
+    "dnt",
+    "sec-fetch-site",
+    "sec-fetch-mode",
+    "sec-fetch-dest",
+    "sec-fetch-user",
+};
+
+//完美哈希:只看长度、首字符和末两个字符,对上面的名字两两不冲突(由header_table_ok在编译期检查)
+//名字里只有字母、数字和'-',|0x20即可转成小写
+static const int HEADER_HASH_SIZE = 64;
+
+static constexpr unsigned header_hash(const char *name, int len)
+{
+    return len < 2 ? 0
+                   : (len + 2 * (name[0] | 0x20) + 7 * (name[len - 1] | 0x20) + 6 * (name[len - 2] | 0x20)) &
+                         (HEADER_HASH_SIZE - 1);
+}
+
+static constexpr int header_len(const char *s)
+{
+    return *s ? 1 + header_len(s + 1) : 0;
+}
+
+//C++11的constexpr函数只能有一条return,表在编译期用下标包展开生成,不写循环
+template <int... I>
+struct index_list
+{
+};
+
+template <int N, int... I>
+struct make_index_list : make_index_list<N - 1, N - 1, I...>
+{
+};
+
+template <int... I>
+struct make_index_list<0, I...>
+{
+    typedef index_list<I...> type;
+};
+
+struct header_table
+{
+    unsigned char slot[HEADER_HASH_SIZE];
+    unsigned char len[HDR_COUNT];
+};
+
+//哈希值为h的第一个名字的下标,从i开始找,没有时为0
+static constexpr int header_slot(unsigned h, int i)
+{
+    return i >= HDR_COUNT ? 0
+                          : header_hash(header_names[i], header_len(header_names[i])) == h ? i : header_slot(h, i + 1);
+}
+
+template <int... S, int... N>
+static constexpr header_table make_header_table(index_list<S...>, index_list<N...>)
+{
+    return header_table{{(unsigned char)header_slot(S, 1)...}, {(unsigned char)header_len(header_names[N])...}};
+}
+
+//每个名字都是自己哈希值上的第一个,即两两不冲突
+static constexpr bool header_table_ok(int i = 1)
+{
+    return i >= HDR_COUNT ? true
+                          : header_slot(header_hash(header_names[i], header_len(header_names[i])), 1) == i &&
+                                header_table_ok(i + 1);
+}
+
+static_assert(header_table_ok(), "header_hash collides, adjust it after changing header_names");
+
+static constexpr header_table header_slots =
+    make_header_table(make_index_list<HEADER_HASH_SIZE>::type(), make_index_list<HDR_COUNT>::type());
+
+//按名字分类,哈希定位后再比较一次名字,不在表里的返回HDR_UNKNOWN
+static inline HEADER_NAME header_id(const char *name, int len)
+{
+    int id = header_slots.slot[header_hash(name, len)];
+    if (id && header_slots.len[id] == len && 0 == strncasecmp(name, header_names[id], len))
+        return (HEADER_NAME)id;
+    return HDR_UNKNOWN;
+}
+
+//指向读缓冲区的一段字符串,不拷贝也不保证以'\0'结尾
+struct str_ref
+{
+    const char *data;
+    int len;
+
+    bool empty() const { return 0 == len; }
+    bool equals(const char *s) const { return (int)strlen(s) == len && 0 == memcmp(data, s, len); }
+    bool equals_nocase(const char *s) const { return (int)strlen(s) == len && 0 == strncasecmp(data, s, len); }
+};
+
+//一个请求头在读缓冲区中的位置
+struct header_field
+{
+    unsigned short name_off;
+    unsigned short name_len;
+    unsigned short value_off;
+    unsigned short value_len;
+    unsigned char id;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <string.h>
+
+#include "http_header.h"
+
+//路由的处理方式
+enum ROUTE_KIND
+{
+    ROUTE_PAGE,     //返回固定的页面
+    ROUTE_LOGIN,    //查用户索引验证密码
+    ROUTE_REGISTER  //新用户写数据库
+};
+
+//允许的请求方法,位的下标与http_conn::METHOD一致
+static const unsigned ROUTE_GET = 1u << 0;
+static const unsigned ROUTE_POST = 1u << 1;
+
+struct route
+{
+    const char *path;
+    unsigned methods;
+    ROUTE_KIND kind;
+    const char *page;       //返回的页面,登录和注册时为成功后的页面
+    const char *error_page; //登录和注册失败时的页面
+};
+
+//页面里表单的action都是相对根目录的这几个路径,其余请求按url取根目录下的文件
+static constexpr route routes[] = {
+    {"/", ROUTE_GET | ROUTE_POST, ROUTE_PAGE, "/judge.html", NULL},
+    {"/0", ROUTE_GET | ROUTE_POST, ROUTE_PAGE, "/register.html", NULL},
+    {"/1", ROUTE_GET | ROUTE_POST, ROUTE_PAGE, "/log.html", NULL},
+    {"/2CGISQL.cgi", ROUTE_POST, ROUTE_LOGIN, "/welcome.html", "/logError.html"},
+    {"/3CGISQL.cgi", ROUTE_POST, ROUTE_REGISTER, "/log.html", "/registerError.html"},
+    {"/5", ROUTE_GET | ROUTE_POST, ROUTE_PAGE, "/picture.html", NULL},
+    {"/6", ROUTE_GET | ROUTE_POST, ROUTE_PAGE, "/video.html", NULL},
+    {"/7", ROUTE_GET | ROUTE_POST, ROUTE_PAGE, "/fans.html", NULL},
+};
+
+static const int ROUTE_COUNT = sizeof(routes) / sizeof(routes[0]);
+
+//完美哈希:只看长度、第二个和最后一个字符,对上面的路径两两不冲突(由route_table_ok在编译期检查)
+static const int ROUTE_HASH_SIZE = 16;
+
+static constexpr unsigned route_hash(const char *path, int len)
+{
+    return len < 2 ? 0 : (4 * len + (unsigned char)path[1] + (unsigned char)path[len - 1]) & (ROUTE_HASH_SIZE - 1);
+}
+
+struct route_table
+{
+    signed char slot[ROUTE_HASH_SIZE]; //路由的下标,-1为空
+    unsigned char len[ROUTE_COUNT];
+};
+
+//哈希值为h的第一个路由的下标,从i开始找,没有时为-1
+static constexpr int route_slot(unsigned h, int i)
+{
+    return i >= ROUTE_COUNT ? -1 : route_hash(routes[i].path, header_len(routes[i].path)) == h ? i : route_slot(h, i + 1);
+}
+
+template <int... S, int... N>
+static constexpr route_table make_route_table(index_list<S...>, index_list<N...>)
+{
+    return route_table{{(signed char)route_slot(S, 0)...}, {(unsigned char)header_len(routes[N].path)...}};
+}
+
+static constexpr bool route_table_ok(int i = 0)
+{
+    return i >= ROUTE_COUNT ? true
+                            : route_slot(route_hash(routes[i].path, header_len(routes[i].path)), 0) == i &&
+                                  route_table_ok(i + 1);
+}
+
+static_assert(route_table_ok(), "route_hash collides, adjust it after changing routes");
+
+static constexpr route_table route_slots =
+    make_route_table(make_index_list<ROUTE_HASH_SIZE>::type(), make_index_list<ROUTE_COUNT>::type());
+
+//path指向读缓冲区中的url,不含查询串;路径不在表里或方法不允许时返回NULL
+static inline const route *find_route(str_ref path, int method)
+{
+    int i = route_slots.slot[route_hash(path.data, path.len)];
+    if (i < 0 || route_slots.len[i] != path.len || 0 != memcmp(path.data, routes[i].path, path.len))
+        return NULL;
+    if (!(routes[i].methods & (1u << method)))
+        return NULL;
+    return &routes[i];
+}
+
+#endif
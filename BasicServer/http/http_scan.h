@@ -0,0 +1,79 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//请求解析用的字符扫描,在[p,end)中找第一个等于a或b的字节,找不到返回end
+//x86上按编译选项用AVX2(32字节)或SSE2(16字节),树莓派的Cortex-A72用NEON(16字节),其他平台逐字节
+//向量循环只加载完整落在[p,end)内的块,尾部逐字节处理,不会越界读
+static inline const char *scan_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+static inline const char *scan_any2(const char *p, const char *end, char a, char b)
+{
+#if defined(__AVX2__)
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i sa = _mm_set1_epi8(a);
+    const __m128i sb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, sa), _mm_cmpeq_epi8(v, sb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t na = vdupq_n_u8((uint8_t)a);
+    const uint8x16_t nb = vdupq_n_u8((uint8_t)b);
+    for (; end - p >= 16; p += 16)
+    {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p);
+        uint8x16_t eq = vorrq_u8(vceqq_u8(v, na), vceqq_u8(v, nb));
+        //NEON没有movemask,每个字节窄化成4位后得到64位掩码
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask)
+            return p + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    return scan_scalar(p, end, a, b);
+}
+
+//行结束符
+static inline const char *scan_eol(const char *p, const char *end)
+{
+    return scan_any2(p, end, '\r', '\n');
+}
+
+//请求行中的分隔符
+static inline const char *scan_blank(const char *p, const char *end)
+{
+    return scan_any2(p, end, ' ', '\t');
+}
+
+#endif
@@ -16,7 +16,10 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.reactor_num,
+                config.io_backend, config.tick_ms, config.lazy_timer,
+                config.queue_size, config.thread_max, config.send_file,
+                config.cache_mb);
     
 
     //日志
@@ -28,6 +31,9 @@ int main(int argc, char *argv[])
     //线程池
     server.thread_pool();
 
+    //静态文件缓存
+    server.static_cache();
+
     //触发模式
     server.trig_mode();
 
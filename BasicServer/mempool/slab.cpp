@@ -0,0 +1,80 @@
+#include "slab.h"
+
+#include <sys/mman.h>
+
+static const size_t CACHE_LINE = 64;
+
+slab::slab(size_t size, size_t per_chunk)
+    : m_per_chunk(per_chunk), m_free(NULL), m_next(NULL), m_end(NULL), m_in_use(0)
+{
+    if (size < sizeof(node))
+        size = sizeof(node);
+    m_size = (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+}
+
+slab::~slab()
+{
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+        munmap(m_chunks[i], m_size * m_per_chunk);
+}
+
+void *slab::alloc()
+{
+    m_lock.lock();
+    void *p = NULL;
+    if (m_free)
+    {
+        p = m_free;
+        m_free = m_free->next;
+    }
+    else
+    {
+        //当前chunk分完再向系统要一片,块只在第一次分出时才被写到
+        if (m_next == m_end)
+        {
+            char *chunk = (char *)mmap(NULL, m_size * m_per_chunk, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (MAP_FAILED == chunk)
+            {
+                m_lock.unlock();
+                return NULL;
+            }
+            m_chunks.push_back(chunk);
+            m_next = chunk;
+            m_end = chunk + m_size * m_per_chunk;
+        }
+        p = m_next;
+        m_next += m_size;
+    }
+    ++m_in_use;
+    m_lock.unlock();
+    return p;
+}
+
+void slab::free(void *p)
+{
+    if (!p)
+        return;
+    m_lock.lock();
+    node *n = (node *)p;
+    n->next = m_free;
+    m_free = n;
+    --m_in_use;
+    m_lock.unlock();
+}
+
+size_t slab::in_use()
+{
+    m_lock.lock();
+    size_t n = m_in_use;
+    m_lock.unlock();
+    return n;
+}
+
+size_t slab::reserved()
+{
+    m_lock.lock();
+    size_t n = m_chunks.size() * m_size * m_per_chunk;
+    m_lock.unlock();
+    return n;
+}
@@ -0,0 +1,43 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "../lock/locker.h"
+
+//定长对象分配器:每次向系统要一整片(chunk),按块大小切开使用
+//释放的块挂到空闲链表上,下次优先复用;内存不还给系统
+//chunk用匿名mmap,还没分出去的块不占物理内存,连接数多少RSS就涨多少
+class slab
+{
+public:
+    //size为对象大小,按缓存行对齐,避免不同线程使用的相邻对象共享缓存行
+    slab(size_t size, size_t per_chunk);
+    ~slab();
+
+    //内存不足时返回NULL
+    void *alloc();
+    void free(void *p);
+
+    size_t obj_size() const { return m_size; }
+    size_t in_use();        //已分配出去的块数
+    size_t reserved();      //已向系统申请的字节数
+
+private:
+    struct node
+    {
+        node *next;
+    };
+
+    size_t m_size;
+    size_t m_per_chunk;
+    node *m_free;       //已释放的块
+    char *m_next;       //当前chunk中还没分出去的第一个块
+    char *m_end;
+    size_t m_in_use;
+    std::vector<char *> m_chunks;
+    locker m_lock;
+};
+
+#endif
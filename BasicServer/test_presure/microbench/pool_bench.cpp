@@ -0,0 +1,206 @@
+/*************************************************************
+*线程池微基准:对比原std::list+互斥锁+信号量的线程池与工作窃取线程池
+*(每个工作线程的队列分别为互斥锁+deque和无锁MPMC环形队列)
+*若干提交线程模拟事件循环:
+*  吞吐:提交线程尽快append,测量任务/秒
+*  延迟:每个提交线程一次只有一个任务在途,测量append到开始执行的p50/p99
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "../../threadpool/threadpool.h"
+
+//基准程序不链接数据库连接池,connectionRAII置空
+connectionRAII::connectionRAII(MYSQL **, connection_pool *) {}
+connectionRAII::~connectionRAII() {}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static std::atomic<int> done(0);
+
+//模拟http_conn,process里只做一点计算
+struct bench_task
+{
+    enum REQUEST_LANE
+    {
+        STATIC_LANE = 0,
+        DB_LANE
+    };
+
+    MYSQL *mysql;
+    int m_state;
+    int improv;
+    int timer_flag;
+    int lane_flag;
+    double submit_ns;
+    double latency_ns;
+    std::atomic<int> finished;
+
+    bool read_once() { return true; }
+    bool write() { return true; }
+    REQUEST_LANE request_lane() { return STATIC_LANE; }
+    void hold() {}
+    void hand_back() {}
+    void process(REQUEST_LANE)
+    {
+        latency_ns = now_ns() - submit_ns;
+        volatile unsigned x = 0;
+        for (int i = 0; i < 200; ++i)
+            x += i;
+        ++done;
+        finished = 1;
+    }
+};
+
+//原先的线程池实现,仅作对比
+template <typename T>
+class list_pool
+{
+public:
+    list_pool(int, connection_pool *, int thread_number, int max_requests)
+        : m_max_requests(max_requests), m_stop(false)
+    {
+        pthread_mutex_init(&m_queuelocker, NULL);
+        sem_init(&m_queuestat, 0, 0);
+        for (int i = 0; i < thread_number; ++i)
+        {
+            pthread_t tid;
+            pthread_create(&tid, NULL, worker, this);
+            pthread_detach(tid);
+        }
+    }
+    bool append(T *request)
+    {
+        pthread_mutex_lock(&m_queuelocker);
+        if (m_workqueue.size() >= (size_t)m_max_requests)
+        {
+            pthread_mutex_unlock(&m_queuelocker);
+            return false;
+        }
+        m_workqueue.push_back(request);
+        pthread_mutex_unlock(&m_queuelocker);
+        sem_post(&m_queuestat);
+        return true;
+    }
+
+private:
+    static void *worker(void *arg)
+    {
+        list_pool *pool = (list_pool *)arg;
+        while (!pool->m_stop)
+        {
+            sem_wait(&pool->m_queuestat);
+            pthread_mutex_lock(&pool->m_queuelocker);
+            if (pool->m_workqueue.empty())
+            {
+                pthread_mutex_unlock(&pool->m_queuelocker);
+                continue;
+            }
+            T *request = pool->m_workqueue.front();
+            pool->m_workqueue.pop_front();
+            pthread_mutex_unlock(&pool->m_queuelocker);
+            request->process(T::STATIC_LANE);
+        }
+        return pool;
+    }
+
+    int m_max_requests;
+    bool m_stop;
+    std::list<T *> m_workqueue;
+    pthread_mutex_t m_queuelocker;
+    sem_t m_queuestat;
+};
+
+const int PRODUCERS = 4;
+const int TASKS = 200000;
+const int LATENCY_TASKS = 20000;
+const int WORKERS = 8;
+
+template <typename POOL>
+struct producer_arg
+{
+    POOL *pool;
+    bench_task *tasks;
+    int count;
+    bool closed_loop;   //等上一个任务执行完再提交下一个
+};
+
+template <typename POOL>
+static void *producer(void *arg)
+{
+    producer_arg<POOL> *p = (producer_arg<POOL> *)arg;
+    for (int i = 0; i < p->count; ++i)
+    {
+        bench_task *task = p->tasks + i;
+        task->submit_ns = now_ns();
+        while (!p->pool->append(task))
+            sched_yield();
+        while (p->closed_loop && !task->finished)
+            sched_yield();
+    }
+    return NULL;
+}
+
+template <typename POOL>
+static void run(const char *name, POOL *pool, int total, bool closed_loop)
+{
+    std::vector<bench_task> tasks(total);
+    done = 0;
+
+    double t0 = now_ns();
+    pthread_t tids[PRODUCERS];
+    producer_arg<POOL> args[PRODUCERS];
+    int per = total / PRODUCERS;
+    for (int i = 0; i < PRODUCERS; ++i)
+    {
+        args[i].pool = pool;
+        args[i].tasks = &tasks[i * per];
+        args[i].count = per;
+        args[i].closed_loop = closed_loop;
+        pthread_create(&tids[i], NULL, producer<POOL>, &args[i]);
+    }
+    for (int i = 0; i < PRODUCERS; ++i)
+        pthread_join(tids[i], NULL);
+    while (done < per * PRODUCERS)
+        usleep(100);
+    double t1 = now_ns();
+
+    std::vector<double> lat(per * PRODUCERS);
+    for (size_t i = 0; i < lat.size(); ++i)
+        lat[i] = tasks[i].latency_ns;
+    std::sort(lat.begin(), lat.end());
+
+    if (closed_loop)
+        printf("%-14s latency     p50 %8.1f us  p99 %8.1f us\n",
+               name, lat[lat.size() / 2] / 1e3, lat[lat.size() * 99 / 100] / 1e3);
+    else
+        printf("%-14s throughput  %10.0f tasks/s\n", name, lat.size() / ((t1 - t0) / 1e9));
+}
+
+template <typename POOL>
+static void bench(const char *name)
+{
+    //线程池的工作线程是分离的且不会退出,基准程序直接泄漏pool
+    POOL *pool = new POOL(0, NULL, WORKERS, TASKS);
+    run(name, pool, TASKS, false);
+    run(name, pool, LATENCY_TASKS, true);
+}
+
+int main()
+{
+    printf("producers=%d workers=%d cpus=%ld\n", PRODUCERS, WORKERS, sysconf(_SC_NPROCESSORS_ONLN));
+    bench<list_pool<bench_task> >("list_pool");
+    bench<ThreadPool<bench_task, locked_queue<bench_task *> > >("locked_deque");
+    bench<ThreadPool<bench_task, mpmc_queue<bench_task *> > >("mpmc_ring");
+    return 0;
+}
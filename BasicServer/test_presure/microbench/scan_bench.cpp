@@ -0,0 +1,153 @@
+/*************************************************************
+*请求扫描微基准:对比原parse_line逐字节状态机+strpbrk与向量化扫描
+*对几组真实浏览器的请求头,切分出请求行和全部头部行,并在请求行里找出方法/URL/版本
+*  byte_loop  原实现:逐字节找\r\n,strpbrk找空格
+*  scalar     http_scan.h的逐字节回退版本
+*  simd       http_scan.h按编译选项选择的版本(make scan_bench_avx2为AVX2版本)
+**************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include "../../http/http_scan.h"
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char *chrome =
+    "GET /RASPBERRY4B.png HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://192.168.1.20:9006/5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; session=6f1c2a9b8e7d4c3b2a19087f6e5d4c3b\r\n"
+    "\r\n";
+
+static const char *firefox =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: localhost:9006\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "If-Modified-Since: Fri, 14 Mar 2025 08:00:00 GMT\r\n"
+    "\r\n";
+
+static const char *curl =
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+//原parse_line:逐字节找行尾
+static int byte_loop(char *buf, int len)
+{
+    int checked = 0, start = 0, lines = 0;
+    int sink = 0;
+    for (; checked < len; ++checked)
+    {
+        char c = buf[checked];
+        if (c == '\r' && checked + 1 < len && buf[checked + 1] == '\n')
+        {
+            buf[checked] = '\0';
+            if (0 == lines)
+            {
+                char *url = strpbrk(buf + start, " \t");
+                char *version = url ? strpbrk(url + 1, " \t") : NULL;
+                sink += version ? version - url : 0;
+            }
+            buf[checked] = '\r';
+            ++lines;
+            start = checked + 2;
+            ++checked;
+        }
+    }
+    return lines + sink;
+}
+
+template <const char *(*SCAN)(const char *, const char *, char, char)>
+static int scan_lines(char *buf, int len)
+{
+    const char *p = buf, *end = buf + len;
+    int lines = 0, sink = 0;
+    while (p < end)
+    {
+        const char *eol = SCAN(p, end, '\r', '\n');
+        if (eol + 1 >= end)
+            break;
+        if (0 == lines)
+        {
+            const char *url = SCAN(p, eol, ' ', '\t');
+            const char *version = url < eol ? SCAN(url + 1, eol, ' ', '\t') : eol;
+            sink += version - url;
+        }
+        ++lines;
+        p = eol + 2;
+    }
+    return lines + sink;
+}
+
+static void run(const char *set, const char *name, int (*fn)(char *, int))
+{
+    const int N = 2000000;
+    std::string req(set);
+    std::vector<char> buf(req.begin(), req.end());
+    int len = buf.size();
+    volatile int sink = 0;
+
+    for (int i = 0; i < 10000; ++i)
+        sink += fn(&buf[0], len);
+    double t0 = now_ns();
+    for (int i = 0; i < N; ++i)
+        sink += fn(&buf[0], len);
+    double t1 = now_ns();
+    double ns = (t1 - t0) / N;
+    printf("  %-10s %7.1f ns/request  %5.2f GB/s\n", name, ns, len / ns);
+}
+
+static void bench(const char *title, const char *set)
+{
+    printf("%s (%d bytes)\n", title, (int)strlen(set));
+    run(set, "byte_loop", byte_loop);
+    run(set, "scalar", scan_lines<scan_scalar>);
+    run(set, "simd", scan_lines<scan_any2>);
+}
+
+int main()
+{
+#if defined(__AVX2__)
+    printf("simd = AVX2\n");
+#elif defined(__SSE2__)
+    printf("simd = SSE2\n");
+#elif defined(__ARM_NEON)
+    printf("simd = NEON\n");
+#else
+    printf("simd = scalar\n");
+#endif
+    bench("chrome", chrome);
+    bench("firefox", firefox);
+    bench("curl", curl);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*************************************************************
+*定时器微基准:对比原升序链表与分层时间轮
+*在1k/10k/60k个连接下测量添加、刷新(keep-alive续期)、空转tick和到期处理的单次耗时
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "../../timer/lst_timer.h"
+
+//原先的升序链表实现,仅作对比
+class sort_timer_lst
+{
+public:
+    sort_timer_lst() : head(NULL), tail(NULL) {}
+    ~sort_timer_lst()
+    {
+        while (head)
+        {
+            util_timer *tmp = head->next;
+            delete head;
+            head = tmp;
+        }
+    }
+    void add_timer(util_timer *timer)
+    {
+        if (!head)
+        {
+            head = tail = timer;
+            return;
+        }
+        if (timer->expire < head->expire)
+        {
+            timer->next = head;
+            head->prev = timer;
+            head = timer;
+            return;
+        }
+        add_timer(timer, head);
+    }
+    void adjust_timer(util_timer *timer)
+    {
+        util_timer *tmp = timer->next;
+        if (!tmp || (timer->expire < tmp->expire))
+            return;
+        if (timer == head)
+        {
+            head = head->next;
+            head->prev = NULL;
+            timer->next = NULL;
+            add_timer(timer, head);
+        }
+        else
+        {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+            add_timer(timer, timer->next);
+        }
+    }
+    void tick(time_t cur)
+    {
+        util_timer *tmp = head;
+        while (tmp && cur >= tmp->expire)
+        {
+            tmp->cb_func(tmp->user_data);
+            head = tmp->next;
+            if (head)
+                head->prev = NULL;
+            delete tmp;
+            tmp = head;
+        }
+    }
+
+private:
+    void add_timer(util_timer *timer, util_timer *lst_head)
+    {
+        util_timer *prev = lst_head;
+        util_timer *tmp = prev->next;
+        while (tmp)
+        {
+            if (timer->expire < tmp->expire)
+            {
+                prev->next = timer;
+                timer->next = tmp;
+                tmp->prev = timer;
+                timer->prev = prev;
+                return;
+            }
+            prev = tmp;
+            tmp = tmp->next;
+        }
+        prev->next = timer;
+        timer->prev = prev;
+        timer->next = NULL;
+        tail = timer;
+    }
+
+    util_timer *head;
+    util_timer *tail;
+};
+
+static int expired = 0;
+static bool bench_cb(client_data *)
+{
+    ++expired;
+    return true;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+const time_t TIMEOUT_MS = 15000;
+const int REFRESHES = 200000;
+const int TICKS = 1000;
+
+template <typename LIST>
+static void run(const char *name, LIST &lst, int conns, time_t base)
+{
+    std::vector<util_timer *> timers(conns);
+    std::vector<client_data> data(conns);
+    srand(1);
+
+    double t0 = now_ns();
+    for (int i = 0; i < conns; ++i)
+    {
+        util_timer *timer = new util_timer;
+        timer->user_data = &data[i];
+        timer->cb_func = bench_cb;
+        timer->expire = base + TIMEOUT_MS + rand() % 1000;
+        timers[i] = timer;
+        lst.add_timer(timer);
+    }
+    double t1 = now_ns();
+
+    //keep-alive续期:随机挑一个连接把到期时间往后推,时间随请求缓慢前进
+    time_t cur = base;
+    for (int i = 0; i < REFRESHES; ++i)
+    {
+        if (0 == i % 1000)
+            cur += 1;
+        util_timer *timer = timers[rand() % conns];
+        timer->expire = cur + TIMEOUT_MS + rand() % 1000;
+        lst.adjust_timer(timer);
+    }
+    double t2 = now_ns();
+
+    //tick:超时前的空转tick,模拟每tick_ms检查一次
+    for (int i = 0; i < TICKS; ++i)
+        lst.tick(cur + i);
+    double t3 = now_ns();
+
+    //到期:逐tick走过全部到期时间,所有定时器都在这段时间里回调
+    //到期时间分散在1000多个tick上,时间轮要从上层槽逐级下放
+    int before = expired;
+    time_t end = cur + TIMEOUT_MS + 1000;
+    int ticks = 0;
+    for (time_t t = cur + TICKS; t <= end; ++t, ++ticks)
+        lst.tick(t);
+    double t4 = now_ns();
+    int fired = expired - before;
+
+    printf("%-12s conns=%6d  add %8.1f ns/op  refresh %10.1f ns/op  idle tick %8.1f ns/op  "
+           "expire %8.1f ns/timer (%d timers, %d ticks)\n",
+           name, conns, (t1 - t0) / conns, (t2 - t1) / REFRESHES, (t3 - t2) / TICKS,
+           (t4 - t3) / fired, fired, ticks);
+}
+
+int main()
+{
+    int sizes[] = {1000, 10000, 60000};
+    for (int i = 0; i < 3; ++i)
+    {
+        time_t base = monotonic_ms();
+        {
+            time_wheel wheel;
+            wheel.init(1);
+            run("time_wheel", wheel, sizes[i], base);
+        }
+        {
+            sort_timer_lst lst;
+            run("sorted_list", lst, sizes[i], base);
+        }
+    }
+    return 0;
+}
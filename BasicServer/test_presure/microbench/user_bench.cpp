@@ -0,0 +1,189 @@
+/*************************************************************
+*用户索引微基准:多个工作线程并发登录查询,同时有一个线程不停注册新用户
+*预先载入10万个用户,每组运行1秒,输出查询总吞吐和同期完成的注册数
+*  map_mutex   std::map,查询和插入都加同一把互斥锁
+*  map_rwlock  std::map,查询加读锁,插入加写锁
+*  user_index  开放寻址扁平表,查询不加锁,单写者发布
+*原实现查询不加锁、插入加锁,与插入并发时是数据竞争,结果不可信,不参与对比
+**************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "../../CGImysql/user_index.h"
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct map_mutex
+{
+    std::map<std::string, std::string> users;
+    pthread_mutex_t lock;
+
+    map_mutex() { pthread_mutex_init(&lock, NULL); }
+    bool verify(const char *name, const char *passwd)
+    {
+        pthread_mutex_lock(&lock);
+        std::map<std::string, std::string>::iterator it = users.find(name);
+        bool ok = it != users.end() && it->second == passwd;
+        pthread_mutex_unlock(&lock);
+        return ok;
+    }
+    bool insert(const char *name, const char *passwd)
+    {
+        pthread_mutex_lock(&lock);
+        bool ok = users.insert(std::make_pair(std::string(name), std::string(passwd))).second;
+        pthread_mutex_unlock(&lock);
+        return ok;
+    }
+};
+
+struct map_rwlock
+{
+    std::map<std::string, std::string> users;
+    pthread_rwlock_t lock;
+
+    map_rwlock() { pthread_rwlock_init(&lock, NULL); }
+    bool verify(const char *name, const char *passwd)
+    {
+        pthread_rwlock_rdlock(&lock);
+        std::map<std::string, std::string>::iterator it = users.find(name);
+        bool ok = it != users.end() && it->second == passwd;
+        pthread_rwlock_unlock(&lock);
+        return ok;
+    }
+    bool insert(const char *name, const char *passwd)
+    {
+        pthread_rwlock_wrlock(&lock);
+        bool ok = users.insert(std::make_pair(std::string(name), std::string(passwd))).second;
+        pthread_rwlock_unlock(&lock);
+        return ok;
+    }
+};
+
+static const int PRELOAD = 100000;
+static const int NEW_USERS = 2000000;
+static std::vector<std::string> names;
+static std::vector<std::string> new_names;
+
+template <typename INDEX>
+struct run_ctx
+{
+    INDEX *index;
+    std::atomic<bool> stop;
+    std::atomic<long> lookups;
+    std::atomic<long> hits;
+    long inserts;
+};
+
+template <typename INDEX>
+static void *reader(void *arg)
+{
+    run_ctx<INDEX> *ctx = (run_ctx<INDEX> *)arg;
+    unsigned x = (unsigned)(uintptr_t)&x | 1;
+    long n = 0, hit = 0;
+    while (!ctx->stop.load(std::memory_order_relaxed))
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            //一成查询用错误的密码
+            hit += ctx->index->verify(names[x % PRELOAD].c_str(), (x & 15) ? "passwd" : "wrong");
+        }
+        n += 256;
+    }
+    ctx->lookups += n;
+    ctx->hits += hit;
+    return NULL;
+}
+
+template <typename INDEX>
+static void *writer(void *arg)
+{
+    run_ctx<INDEX> *ctx = (run_ctx<INDEX> *)arg;
+    long n = 0;
+    while (!ctx->stop.load(std::memory_order_relaxed) && n < NEW_USERS)
+    {
+        ctx->index->insert(new_names[n].c_str(), "passwd");
+        ++n;
+    }
+    ctx->inserts = n;
+    return NULL;
+}
+
+template <typename INDEX>
+static void bench(const char *title, int readers, bool writing)
+{
+    INDEX *index = new INDEX;
+    for (int i = 0; i < PRELOAD; ++i)
+        index->insert(names[i].c_str(), "passwd");
+
+    run_ctx<INDEX> ctx;
+    ctx.index = index;
+    ctx.stop = false;
+    ctx.lookups = 0;
+    ctx.hits = 0;
+    ctx.inserts = 0;
+
+    std::vector<pthread_t> tids(readers);
+    pthread_t wtid;
+    double t0 = now_ns();
+    for (int i = 0; i < readers; ++i)
+        pthread_create(&tids[i], NULL, reader<INDEX>, &ctx);
+    if (writing)
+        pthread_create(&wtid, NULL, writer<INDEX>, &ctx);
+    usleep(1000 * 1000);
+    ctx.stop = true;
+    for (int i = 0; i < readers; ++i)
+        pthread_join(tids[i], NULL);
+    if (writing)
+        pthread_join(wtid, NULL);
+    double secs = (now_ns() - t0) / 1e9;
+
+    printf("  %-11s %2d readers%s  %8.2f M lookups/s  %7.1f ns/lookup/thread  %8ld inserts\n", title, readers,
+           writing ? " + writer" : "         ", ctx.lookups / secs / 1e6, secs * 1e9 * readers / ctx.lookups,
+           ctx.inserts);
+    delete index;
+}
+
+int main()
+{
+    char buf[32];
+    for (int i = 0; i < PRELOAD; ++i)
+    {
+        snprintf(buf, sizeof(buf), "user%d", i);
+        names.push_back(buf);
+    }
+    for (int i = 0; i < NEW_USERS; ++i)
+    {
+        snprintf(buf, sizeof(buf), "new%d", i);
+        new_names.push_back(buf);
+    }
+
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int counts[] = {1, 4, cpus};
+    for (int c = 0; c < 3; ++c)
+    {
+        if (c > 0 && counts[c] <= counts[c - 1])
+            continue;
+        for (int w = 0; w < 2; ++w)
+        {
+            bench<map_mutex>("map_mutex", counts[c], w);
+            bench<map_rwlock>("map_rwlock", counts[c], w);
+            bench<user_index>("user_index", counts[c], w);
+        }
+    }
+    return 0;
+}
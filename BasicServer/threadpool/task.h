@@ -0,0 +1,195 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>
+#include <new>
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Move-only type-erased callable. Callables up to INLINE_SIZE bytes are stored
+// in place, so posting a lambda that captures a few pointers or integers does
+// not allocate; larger ones fall back to the heap.
+class task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    task() : m_ops(NULL) {}
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, task>::value>::type>
+    task(F&& f) : m_ops(NULL) {
+        typedef typename std::decay<F>::type Fn;
+        if(sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)
+           && std::is_nothrow_move_constructible<Fn>::value) {
+            new (m_storage) Fn(std::forward<F>(f));
+            m_ops = &inline_ops<Fn>::table;
+        }
+        else {
+            *reinterpret_cast<Fn**>(m_storage) = new Fn(std::forward<F>(f));
+            m_ops = &heap_ops<Fn>::table;
+        }
+    }
+
+    task(task&& other) : m_ops(other.m_ops) {
+        if(m_ops) {
+            m_ops->move(m_storage, other.m_storage);
+            other.m_ops = NULL;
+        }
+    }
+
+    task& operator=(task&& other) {
+        if(this != &other) {
+            reset();
+            m_ops = other.m_ops;
+            if(m_ops) {
+                m_ops->move(m_storage, other.m_storage);
+                other.m_ops = NULL;
+            }
+        }
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        reset();
+    }
+
+    explicit operator bool() const { return m_ops != NULL; }
+
+    void operator()() {
+        m_ops->invoke(m_storage);
+    }
+
+    void reset() {
+        if(m_ops) {
+            m_ops->destroy(m_storage);
+            m_ops = NULL;
+        }
+    }
+
+private:
+    struct ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);   // move src into dst and destroy src
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Fn>
+    struct inline_ops {
+        static void invoke(void* s) { (*static_cast<Fn*>(s))(); }
+        static void move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* s) { static_cast<Fn*>(s)->~Fn(); }
+        static const ops table;
+    };
+
+    template<typename Fn>
+    struct heap_ops {
+        static void invoke(void* s) { (**static_cast<Fn**>(s))(); }
+        static void move(void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); }
+        static void destroy(void* s) { delete *static_cast<Fn**>(s); }
+        static const ops table;
+    };
+
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const ops* m_ops;
+};
+
+template<typename Fn>
+const task::ops task::inline_ops<Fn>::table = { invoke, move, destroy };
+
+template<typename Fn>
+const task::ops task::heap_ops<Fn>::table = { invoke, move, destroy };
+
+// Completion handle for a posted job. The submitter owns it and must keep it
+// alive until done(); the worker stores the result, marks it done and then
+// calls the notify hook, which an event loop uses to wake itself (e.g. write
+// its eventfd) so it can pick the result up without blocking.
+class completion_base {
+public:
+    completion_base() : m_done(0), m_notify(NULL), m_arg(NULL) {}
+
+    // Must be set before the job is posted
+    void on_done(void (*notify)(void* arg), void* arg) {
+        m_notify = notify;
+        m_arg = arg;
+    }
+
+    bool done() const { return m_done.load(std::memory_order_acquire) == DONE; }
+
+    // Block the calling thread until the job has run, not for use on an event loop
+    void wait() {
+        // Announce the sleeper so finish() knows it has to wake someone
+        int state = PENDING;
+        m_done.compare_exchange_strong(state, WAITING, std::memory_order_acquire);
+        while(!done()) {
+            syscall(SYS_futex, &m_done, FUTEX_WAIT_PRIVATE, WAITING, NULL, NULL, 0);
+        }
+    }
+
+protected:
+    void finish() {
+        // Read the hook first, the submitter may reuse or free us once m_done is set
+        void (*notify)(void*) = m_notify;
+        void* arg = m_arg;
+        // Event loops only poll done() or rely on the hook, skip the syscall when nobody sleeps
+        if(m_done.exchange(DONE, std::memory_order_acq_rel) == WAITING) {
+            syscall(SYS_futex, &m_done, FUTEX_WAKE_PRIVATE, INT_MAX_WAITERS, NULL, NULL, 0);
+        }
+        if(notify) {
+            notify(arg);
+        }
+    }
+
+private:
+    static const int INT_MAX_WAITERS = 0x7fffffff;
+    static const int PENDING = 0;
+    static const int DONE = 1;
+    static const int WAITING = 2;
+
+    std::atomic<int> m_done;
+    void (*m_notify)(void* arg);
+    void* m_arg;
+};
+
+template<typename R>
+class completion : public completion_base {
+public:
+    R& get() {
+        wait();
+        return m_value;
+    }
+
+    template<typename F>
+    void run(F& f) {
+        m_value = f();
+        finish();
+    }
+
+private:
+    R m_value;
+};
+
+template<>
+class completion<void> : public completion_base {
+public:
+    void get() {
+        wait();
+    }
+
+    template<typename F>
+    void run(F& f) {
+        f();
+        finish();
+    }
+};
+
+#endif
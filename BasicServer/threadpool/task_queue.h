@@ -0,0 +1,169 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <atomic>
+#include <utility>
+#include <exception>
+
+// Queue policies for ThreadPool. Each worker owns one queue; submitters push
+// into it, the owner pops from it and idle workers steal from it.
+//
+//   void init(size_t capacity)  capacity is a lower bound, may be rounded up
+//   bool push(T data)           false when the queue is full
+//   bool pop(T& data)           owner side
+//   bool steal(T& data)         other workers, may give up under contention
+
+// Bounded lock-free MPMC ring buffer (Dmitry Vyukov's algorithm). Every cell
+// carries a sequence number telling producers and consumers whose turn it is,
+// so push and pop are a single CAS on the position with no allocation.
+template<typename T>
+class mpmc_queue {
+public:
+    mpmc_queue() : m_buffer(NULL), m_mask(0) {}
+    ~mpmc_queue() {
+        delete [] m_buffer;
+    }
+
+    void init(size_t capacity) {
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        m_buffer = new cell[size];
+        m_mask = size - 1;
+        for(size_t i = 0; i < size; ++i) {
+            m_buffer[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    bool push(T data) {
+        cell* c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for(;;) {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if(0 == dif) {
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(dif < 0) {
+                return false;
+            }
+            else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = std::move(data);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& data) {
+        cell* c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for(;;) {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(0 == dif) {
+                if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(dif < 0) {
+                return false;
+            }
+            else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        data = std::move(c->data);
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumers are symmetric, a thief dequeues exactly like the owner
+    bool steal(T& data) {
+        return pop(data);
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    cell* m_buffer;
+    size_t m_mask;
+
+    // Producers and consumers hammer different positions, keep them on separate cache lines
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+};
+
+// Mutex-protected deque, the owner works from the front and thieves from the back
+template<typename T>
+class locked_queue {
+public:
+    locked_queue() {
+        if(pthread_mutex_init(&m_lock, NULL) != 0) {
+            throw std::exception();
+        }
+    }
+    ~locked_queue() {
+        pthread_mutex_destroy(&m_lock);
+    }
+
+    void init(size_t capacity) {
+        m_capacity = capacity;
+    }
+
+    bool push(T data) {
+        pthread_mutex_lock(&m_lock);
+        if(m_tasks.size() >= m_capacity) {
+            pthread_mutex_unlock(&m_lock);
+            return false;
+        }
+        m_tasks.push_back(std::move(data));
+        pthread_mutex_unlock(&m_lock);
+        return true;
+    }
+
+    bool pop(T& data) {
+        pthread_mutex_lock(&m_lock);
+        bool ok = !m_tasks.empty();
+        if(ok) {
+            data = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        pthread_mutex_unlock(&m_lock);
+        return ok;
+    }
+
+    bool steal(T& data) {
+        if(pthread_mutex_trylock(&m_lock) != 0) {
+            return false;
+        }
+        bool ok = !m_tasks.empty();
+        if(ok) {
+            data = std::move(m_tasks.back());
+            m_tasks.pop_back();
+        }
+        pthread_mutex_unlock(&m_lock);
+        return ok;
+    }
+
+private:
+    std::deque<T> m_tasks;
+    size_t m_capacity;
+    pthread_mutex_t m_lock;
+};
+
+#endif
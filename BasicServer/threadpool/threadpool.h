@@ -2,149 +2,572 @@
 #define THREADPOOL_H
 
 #include <pthread.h>
-#include <list>
 #include <exception>
 #include <cstdio>
-#include <semaphore.h>
+#include <ctime>
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "task.h"
+#include "task_queue.h"
+#include "../lock/locker.h"
+#include "../CGImysql/sql_connection_pool.h"
+
+// Snapshot of the pool size and its resize decisions
+struct pool_stats {
+    int threads;                    // workers currently running
+    int min_threads;
+    int max_threads;
+    int queued;                     // tasks waiting in the queues
+    long service_us;                // average time a worker spends on one task
+    unsigned long long grown;       // workers started because the estimated queue wait was too long
+    unsigned long long shrunk;      // workers retired after idling for idle_ms
+};
 
 // Thread pool class, defined as a template class for code reuse
-template<typename T>
+//
+// Work-stealing: every worker owns a queue. A submitting thread (an event
+// loop) is bound to one home worker and always pushes there, so requests from
+// one reactor stay on the same worker and the submitters do not contend on a
+// shared lock. Idle workers steal from the other queues, spin for a short
+// while and then park on a futex.
+//
+// Elastic: the pool starts with min_threads workers. When the tasks already
+// queued would take longer than target_wait_us to drain at the measured
+// service time, append() starts another worker, up to max_threads. A worker
+// that stays parked for idle_ms retires, down to min_threads. Only the
+// highest-numbered worker grows or retires, so live workers are always
+// 0..threads-1; queues of retired workers are still drained by stealing.
+// Growing and retiring both happen under m_resize_lock, and a slot is only
+// reused once the worker that retired from it has exited and been joined.
+//
+// Besides T* requests the pool runs arbitrary move-only callables (post()),
+// e.g. log flushing or coroutine offloads, from one shared ring. Workers pick
+// them up when they find no request to run. Posted jobs count against
+// max_requests and towards growth just like requests.
+//
+// Queue is the per-worker queue policy from task_queue.h. The default is the
+// lock-free mpmc_queue; locked_queue is the mutex + deque variant.
+template<typename T, typename Queue = mpmc_queue<T*> >
 class ThreadPool {
 public:
-    // thread_number is the number of threads in the thread pool
-    // max_requests is the maximum number of requests allowed in the request queue waiting for processing
-    ThreadPool(int thread_number = 8, int max_requests = 10000);
+    // actor_model selects reactor (1) or proactor (everything else) handling
+    // connPool may be NULL for a pool whose tasks never touch the database
+    // thread_number is the number of threads the pool starts with and never goes below
+    // max_requests is the maximum number of requests allowed in the request queues waiting for processing
+    // max_threads caps growth, 0 keeps the pool at thread_number
+    ThreadPool(int actor_model, connection_pool* connPool, int thread_number = 8, int max_requests = 10000,
+               int max_threads = 0, int target_wait_us = 2000, int idle_ms = 30000);
     ~ThreadPool();
-    
-    // Add a task to the request queue
+
+    // Add a task whose data has already been read (proactor)
     bool append(T* request);
 
+    // Add a task that still needs its I/O done, state 0 is read and 1 is write (reactor)
+    bool append(T* request, int state);
+
+    // Run f() on a worker, false when max_requests tasks are already waiting
+    template<typename F>
+    bool post(F&& f);
+
+    // Same, storing the result in *done and firing its notify hook; *done must outlive the job
+    template<typename F, typename R>
+    bool post(F&& f, completion<R>* done);
+
+    // Number of requests and jobs waiting in the queues, read by the event loops without locking
+    int queued() const { return m_queued; }
+    int max_requests() const { return m_max_requests; }
+
+    pool_stats stats() const;
+
 private:
-    // Function run by worker threads, continuously taking tasks from the work queue and executing them
+    // Per-worker task queue, padded so neighbouring workers do not share a cache line
+    struct alignas(64) worker_queue {
+        Queue tasks;
+        std::atomic<int> sleeping;  // futex word, 1 while the worker is parked or about to park
+        std::atomic<long> service_ns;  // moving average of time per request or job, written by the owner only
+        ThreadPool* pool;
+        int index;
+        pthread_t tid;
+        bool joinable;              // a thread was started on this slot and not joined yet, under m_resize_lock
+        std::atomic<bool> exited;   // set by a retired worker as its last action
+    };
+
+    // Function run by worker threads, continuously taking tasks from the work queues and executing them
     static void* worker(void* arg);
-    void run();
+    void run(worker_queue* self);
+    bool spawn(int index);
+
+    // Pop from our own queue first, then try to steal from the others, then a posted job
+    bool take(worker_queue* self, T*& request, task& job);
+    void execute(worker_queue* self, T* request, task& job);
+
+    // Home worker of the calling thread in this pool
+    static const int MAX_POOLS = 4;
+    int home_index();
+
+    // Wake the home worker if it sleeps, otherwise any sleeping worker so it can steal
+    void wake(int home);
+
+    // Park until woken, false if idle_ms passed without a wakeup
+    bool park(worker_queue* self);
+
+    // Start one more worker if the queued tasks would wait longer than the target
+    void maybe_grow(int queued);
+
+    // Retire the calling worker if it is the highest-numbered one and the pool is above its minimum
+    bool retire(worker_queue* self);
+
+    void process(T* request);
+    void run_task(T* request);
+
+    static long now_ns();
 
 private:
-    // Number of threads
-    int m_thread_number;
-    
-    // Array describing the thread pool, size is m_thread_number
-    pthread_t* m_threads;
-    
-    // Maximum number of requests allowed in the request queue waiting for processing
+    // Number of threads currently running, and the bounds it moves between
+    std::atomic<int> m_thread_number;
+    int m_min_threads;
+    int m_max_threads;
+
+    // Maximum number of requests allowed in the request queues waiting for processing
     int m_max_requests;
-    
-    // Request queue
-    std::list<T*> m_workqueue;
-    
-    // Mutex lock protecting the request queue
-    pthread_mutex_t m_queuelocker;
-    
-    // Semaphore to indicate if there are tasks to process
-    sem_t m_queuestat;
-    
+
+    // One queue per possible worker, sized for max_threads
+    worker_queue* m_queues;
+
+    // Jobs from post(), shared by all workers, sized for max_requests
+    mpmc_queue<task> m_jobs;
+
+    // How many times an idle worker polls the queues before parking, 0 on a single CPU
+    int m_spin;
+
+    // Resize policy
+    long m_target_wait_ns;
+    int m_idle_ms;
+    std::atomic<long> m_last_grow_ns;
+    std::atomic<unsigned long long> m_grown;
+    std::atomic<unsigned long long> m_shrunk;
+    locker m_resize_lock;
+
+    // Total requests and jobs in all queues, used for the max_requests bound
+    std::atomic<int> m_queued;
+
+    // Round-robin counter handing out home workers to submitting threads
+    std::atomic<unsigned> m_next_home;
+
     // Flag to end threads
-    bool m_stop;
+    std::atomic<bool> m_stop;
+
+    // Database connection pool
+    connection_pool* m_connPool;
+
+    // Concurrency model switch
+    int m_actor_model;
 };
 
-template<typename T>
-ThreadPool<T>::ThreadPool(int thread_number, int max_requests) : 
-    m_thread_number(thread_number), m_max_requests(max_requests), 
-    m_stop(false), m_threads(NULL) {
-    
+template<typename T, typename Queue>
+ThreadPool<T, Queue>::ThreadPool(int actor_model, connection_pool* connPool, int thread_number, int max_requests,
+                                 int max_threads, int target_wait_us, int idle_ms) :
+    m_thread_number(0), m_min_threads(thread_number),
+    m_max_threads(max_threads > thread_number ? max_threads : thread_number),
+    m_max_requests(max_requests), m_queues(NULL),
+    m_spin(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 100 : 0),
+    m_target_wait_ns(target_wait_us * 1000L), m_idle_ms(idle_ms), m_last_grow_ns(0), m_grown(0), m_shrunk(0),
+    m_queued(0), m_next_home(0), m_stop(false), m_connPool(connPool), m_actor_model(actor_model) {
+
     if((thread_number <= 0) || (max_requests <= 0)) {
         throw std::exception();
     }
-    
-    m_threads = new pthread_t[m_thread_number];
-    if(!m_threads) {
-        throw std::exception();
+
+    // Initialize every queue before any worker can steal from it. The minimum
+    // set of workers can hold max_requests between them; when the home queue
+    // is full append() moves on to the next one, and the global count keeps
+    // the total bounded
+    m_queues = new worker_queue[m_max_threads];
+    for(int i = 0; i < m_max_threads; ++i) {
+        worker_queue* q = m_queues + i;
+        q->tasks.init(max_requests / thread_number + 1);
+        q->sleeping = 0;
+        q->service_ns = 0;
+        q->pool = this;
+        q->index = i;
+        q->joinable = false;
+        q->exited = false;
     }
-    
-    // Create thread_number threads and set them as detached threads
+    m_jobs.init(max_requests);
+
+    // Create thread_number threads, joined again in the destructor
     for(int i = 0; i < thread_number; ++i) {
         printf("create the %dth thread\n", i);
-        
-        if(pthread_create(m_threads + i, NULL, worker, this) != 0) {
-            delete [] m_threads;
+
+        if(!spawn(i)) {
             throw std::exception();
         }
-        
-        if(pthread_detach(m_threads[i])) {
-            delete [] m_threads;
-            throw std::exception();
+        ++m_thread_number;
+    }
+}
+
+template<typename T, typename Queue>
+ThreadPool<T, Queue>::~ThreadPool() {
+    // Set under the lock so no worker is started or retires from now on, the slots stay as they are
+    m_resize_lock.lock();
+    m_stop = true;
+    m_resize_lock.unlock();
+
+    // Workers check m_stop after announcing sleep, so waking every parked one is enough to end them
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(int i = 0; i < m_max_threads; ++i) {
+        worker_queue* q = m_queues + i;
+        if(q->sleeping.exchange(0)) {
+            syscall(SYS_futex, &q->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
         }
     }
-    
-    // Initialize mutex and semaphore
-    if(pthread_mutex_init(&m_queuelocker, NULL) != 0) {
-        delete [] m_threads;
-        throw std::exception();
+    for(int i = 0; i < m_max_threads; ++i) {
+        if(m_queues[i].joinable) {
+            pthread_join(m_queues[i].tid, NULL);
+        }
     }
-    
-    if(sem_init(&m_queuestat, 0, 0) != 0) {
-        delete [] m_threads;
-        pthread_mutex_destroy(&m_queuelocker);
-        throw std::exception();
+    delete [] m_queues;
+}
+
+template<typename T, typename Queue>
+bool ThreadPool<T, Queue>::spawn(int index) {
+    worker_queue* q = m_queues + index;
+    q->exited = false;
+    if(pthread_create(&q->tid, NULL, worker, q) != 0) {
+        return false;
     }
+    q->joinable = true;
+    return true;
 }
 
-template<typename T>
-ThreadPool<T>::~ThreadPool() {
-    m_stop = true;
-    delete [] m_threads;
-    pthread_mutex_destroy(&m_queuelocker);
-    sem_destroy(&m_queuestat);
+template<typename T, typename Queue>
+long ThreadPool<T, Queue>::now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
-template<typename T>
-bool ThreadPool<T>::append(T* request) {
-    // Always lock when operating on the work queue, as it's shared by all threads
-    pthread_mutex_lock(&m_queuelocker);
-    if(m_workqueue.size() > m_max_requests) {
-        pthread_mutex_unlock(&m_queuelocker);
+template<typename T, typename Queue>
+bool ThreadPool<T, Queue>::append(T* request) {
+    // Reserve a slot first so the bound holds across all queues
+    int queued = m_queued.fetch_add(1);
+    if(queued >= m_max_requests) {
+        --m_queued;
         return false;
     }
-    
-    m_workqueue.push_back(request);
-    pthread_mutex_unlock(&m_queuelocker);
-    
-    // Increase semaphore, notify worker threads that a new task has arrived
-    sem_post(&m_queuestat);
+
+    int threads = m_thread_number.load(std::memory_order_relaxed);
+    int index = home_index();
+
+    // The submitter may not free the request until the worker hands it back at the end of process()
+    request->hold();
+
+    // The reservation guarantees a free slot in some queue
+    while(!m_queues[index].tasks.push(request)) {
+        index = (index + 1) % m_max_threads;
+    }
+
+    wake(index);
+
+    // Cheap test first: a backlog shorter than the worker count never needs more workers
+    if(queued >= threads && threads < m_max_threads) {
+        maybe_grow(queued);
+    }
     return true;
 }
 
-template<typename T>
-void* ThreadPool<T>::worker(void* arg) {
-    ThreadPool* pool = (ThreadPool*)arg;
-    pool->run();
-    return pool;
+template<typename T, typename Queue>
+int ThreadPool<T, Queue>::home_index() {
+    // Each submitting thread keeps the same home worker in each pool for its whole life.
+    // The thread_locals are shared by every pool of this type, so they map pool -> home
+    static thread_local const ThreadPool* pools[MAX_POOLS];
+    static thread_local unsigned homes[MAX_POOLS];
+    int threads = m_thread_number.load(std::memory_order_relaxed);
+    for(int i = 0; i < MAX_POOLS; ++i) {
+        if(pools[i] == this) {
+            return homes[i] % threads;
+        }
+        if(!pools[i]) {
+            pools[i] = this;
+            homes[i] = m_next_home.fetch_add(1);
+            return homes[i] % threads;
+        }
+    }
+    // More pools than slots, spread this thread's tasks round-robin instead
+    return m_next_home.fetch_add(1) % threads;
 }
 
-template<typename T>
-void ThreadPool<T>::run() {
+template<typename T, typename Queue>
+template<typename F>
+bool ThreadPool<T, Queue>::post(F&& f) {
+    // Same bound as append(), the ring holds max_requests so a reserved push always fits
+    int queued = m_queued.fetch_add(1);
+    if(queued >= m_max_requests) {
+        --m_queued;
+        return false;
+    }
+    m_jobs.push(task(std::forward<F>(f)));
+
+    int threads = m_thread_number.load(std::memory_order_relaxed);
+    wake(home_index());
+
+    if(queued >= threads && threads < m_max_threads) {
+        maybe_grow(queued);
+    }
+    return true;
+}
+
+template<typename T, typename Queue>
+template<typename F, typename R>
+bool ThreadPool<T, Queue>::post(F&& f, completion<R>* done) {
+    typedef typename std::decay<F>::type Fn;
+    return post([fn = Fn(std::forward<F>(f)), done]() mutable { done->run(fn); });
+}
+
+template<typename T, typename Queue>
+bool ThreadPool<T, Queue>::append(T* request, int state) {
+    // The state is read by the worker after it dequeues the request
+    request->m_state = state;
+    return append(request);
+}
+
+template<typename T, typename Queue>
+void ThreadPool<T, Queue>::maybe_grow(int queued) {
+    int threads = m_thread_number.load();
+    long service = 0;
+    for(int i = 0; i < threads; ++i) {
+        service += m_queues[i].service_ns.load(std::memory_order_relaxed);
+    }
+    service /= threads;
+
+    // Little's law: the backlog drains in about queued * service / threads
+    if(queued * service / threads <= m_target_wait_ns) {
+        return;
+    }
+
+    // Give the previous new worker one target period to make a difference
+    long now = now_ns();
+    long last = m_last_grow_ns.load();
+    if(now - last < m_target_wait_ns || !m_last_grow_ns.compare_exchange_strong(last, now)) {
+        return;
+    }
+
+    m_resize_lock.lock();
+    threads = m_thread_number.load();
+    worker_queue* q = m_queues + threads;
+    // The worker that retired from this slot may still be draining its queue, try again later
+    if(threads >= m_max_threads || m_stop || (q->joinable && !q->exited.load(std::memory_order_acquire))) {
+        m_resize_lock.unlock();
+        return;
+    }
+    if(q->joinable) {
+        pthread_join(q->tid, NULL);
+        q->joinable = false;
+    }
+    q->service_ns = service;
+    if(spawn(threads)) {
+        ++m_thread_number;
+        ++m_grown;
+    }
+    m_resize_lock.unlock();
+}
+
+template<typename T, typename Queue>
+bool ThreadPool<T, Queue>::retire(worker_queue* self) {
+    m_resize_lock.lock();
+    int threads = m_thread_number.load();
+    if(self->index + 1 != threads || threads <= m_min_threads || m_stop) {
+        m_resize_lock.unlock();
+        return false;
+    }
+    --m_thread_number;
+    ++m_shrunk;
+    m_resize_lock.unlock();
+
+    // Submitters that read the old size may still push here, run what is left
+    T* request = NULL;
+    while(self->tasks.pop(request)) {
+        --m_queued;
+        process(request);
+    }
+    // The slot may be handed to a new worker from now on
+    self->exited.store(true, std::memory_order_release);
+    return true;
+}
+
+template<typename T, typename Queue>
+pool_stats ThreadPool<T, Queue>::stats() const {
+    pool_stats s;
+    s.threads = m_thread_number;
+    s.min_threads = m_min_threads;
+    s.max_threads = m_max_threads;
+    s.queued = m_queued;
+    s.service_us = 0;
+    for(int i = 0; i < s.threads; ++i) {
+        s.service_us += m_queues[i].service_ns.load(std::memory_order_relaxed);
+    }
+    s.service_us /= s.threads * 1000L;
+    s.grown = m_grown;
+    s.shrunk = m_shrunk;
+    return s;
+}
+
+template<typename T, typename Queue>
+void ThreadPool<T, Queue>::wake(int home) {
+    // Pairs with the fence in run(): either the worker sees the new task or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(int i = 0; i < m_max_threads; ++i) {
+        worker_queue* q = m_queues + (home + i) % m_max_threads;
+        if(q->sleeping.load(std::memory_order_relaxed) && q->sleeping.exchange(0)) {
+            syscall(SYS_futex, &q->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+            return;
+        }
+    }
+}
+
+template<typename T, typename Queue>
+bool ThreadPool<T, Queue>::park(worker_queue* self) {
+    struct timespec timeout;
+    timeout.tv_sec = m_idle_ms / 1000;
+    timeout.tv_nsec = (m_idle_ms % 1000) * 1000000L;
+
+    // Sleep only while the word is still 1, wake() clears it before waking us
+    while(self->sleeping.load(std::memory_order_acquire)) {
+        if(syscall(SYS_futex, &self->sleeping, FUTEX_WAIT_PRIVATE, 1, &timeout, NULL, 0) < 0
+           && ETIMEDOUT == errno) {
+            // Still 1 means nobody claimed us in the meantime
+            return !self->sleeping.exchange(0);
+        }
+    }
+    return true;
+}
+
+template<typename T, typename Queue>
+void* ThreadPool<T, Queue>::worker(void* arg) {
+    worker_queue* self = (worker_queue*)arg;
+    self->pool->run(self);
+    return self->pool;
+}
+
+template<typename T, typename Queue>
+bool ThreadPool<T, Queue>::take(worker_queue* self, T*& request, task& job) {
+    request = NULL;
+    if(!self->tasks.pop(request)) {
+        for(int i = 1; i < m_max_threads; ++i) {
+            if(m_queues[(self->index + i) % m_max_threads].tasks.steal(request)) {
+                break;
+            }
+        }
+    }
+    if(request || m_jobs.pop(job)) {
+        --m_queued;
+        return true;
+    }
+    return false;
+}
+
+template<typename T, typename Queue>
+void ThreadPool<T, Queue>::execute(worker_queue* self, T* request, task& job) {
+    // Jobs are timed too, with coroutines they are most of the pool's work
+    long start = now_ns();
+    if(request) {
+        process(request);
+    }
+    else {
+        job();
+        job.reset();
+    }
+    long service = self->service_ns.load(std::memory_order_relaxed);
+    self->service_ns.store(service + (now_ns() - start - service) / 8, std::memory_order_relaxed);
+}
+
+template<typename T, typename Queue>
+void ThreadPool<T, Queue>::run(worker_queue* self) {
+    T* request = NULL;
+    task job;
     while(!m_stop) {
-        // Wait for semaphore, wake up when there's a task
-        sem_wait(&m_queuestat);
-        
-        // Acquire mutex lock
-        pthread_mutex_lock(&m_queuelocker);
-        if(m_workqueue.empty()) {
-            pthread_mutex_unlock(&m_queuelocker);
-            continue;
+        bool found = take(self, request, job);
+        for(int i = 0; !found && i < m_spin; ++i) {
+            found = take(self, request, job);
+        }
+        if(!found) {
+            // Announce that we are going to sleep, then look once more so a task
+            // pushed between the failed take and the announcement is not missed
+            self->sleeping.store(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_stop) {
+                break;
+            }
+            if(!take(self, request, job)) {
+                if(!park(self) && retire(self)) {
+                    return;
+                }
+                continue;
+            }
+            self->sleeping.store(0);
+        }
+
+        execute(self, request, job);
+    }
+}
+
+template<typename T, typename Queue>
+void ThreadPool<T, Queue>::process(T* request) {
+    // Reactor: the worker does the I/O and reports back through improv/timer_flag
+    if(1 == m_actor_model) {
+        if(0 == request->m_state) {
+            if(request->read_once()) {
+                // Reads go to the static pool; a request that may touch the database
+                // is handed back to the event loop, which queues it on the database pool
+                if(!m_connPool && T::DB_LANE == request->request_lane()) {
+                    request->lane_flag = 1;
+                    request->improv = 1;
+                }
+                else {
+                    request->improv = 1;
+                    run_task(request);
+                }
+            }
+            else {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
         }
-        
-        // Take the first task from the queue
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        pthread_mutex_unlock(&m_queuelocker);
-        
-        if(!request) {
-            continue;
+        else if(1 == request->m_state) {
+            if(!request->write()) {
+                request->timer_flag = 1;
+            }
+            request->improv = 1;
         }
-        
-        // Execute the task
-        request->process();
+        else {
+            // Pipelined request already in the read buffer: nothing to read and
+            // nobody waits on improv
+            run_task(request);
+        }
+    }
+    else {
+        run_task(request);
+    }
+    // Last access to the request, the event loop may free it from now on
+    request->hand_back();
+}
+
+template<typename T, typename Queue>
+void ThreadPool<T, Queue>::run_task(T* request) {
+    // Execute the task, holding a database connection only if this pool has one
+    if(m_connPool) {
+        {
+            connectionRAII mysqlcon(&request->mysql, m_connPool);
+            request->process(T::DB_LANE);
+        }
+        // The connection is back in the pool, do not leave it on the request
+        request->mysql = NULL;
+    }
+    else {
+        request->process(T::STATIC_LANE);
     }
 }
 
@@ -1,153 +1,188 @@
 #include "lst_timer.h"
-#include "../http/http_conn.h"
 
-sort_timer_lst::sort_timer_lst()
+time_t monotonic_ms()
 {
-    head = NULL;
-    tail = NULL;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
-sort_timer_lst::~sort_timer_lst()
+
+time_wheel::time_wheel()
+{
+    m_tick_ms = 1000;
+    m_base = monotonic_ms();
+    m_jiffies = 0;
+    for (int i = 0; i < ROOT_SIZE; ++i)
+        m_root[i].prev = m_root[i].next = &m_root[i];
+    for (int l = 0; l < LEVELS; ++l)
+        for (int i = 0; i < LEVEL_SIZE; ++i)
+            m_levels[l][i].prev = m_levels[l][i].next = &m_levels[l][i];
+}
+time_wheel::~time_wheel()
+{
+    for (int i = 0; i < ROOT_SIZE; ++i)
+        while (m_root[i].next != &m_root[i])
+            del_timer(m_root[i].next);
+    for (int l = 0; l < LEVELS; ++l)
+        for (int i = 0; i < LEVEL_SIZE; ++i)
+            while (m_levels[l][i].next != &m_levels[l][i])
+                del_timer(m_levels[l][i].next);
+}
+
+void time_wheel::init(int tick_ms)
+{
+    m_tick_ms = tick_ms > 0 ? tick_ms : 1;
+    m_base = monotonic_ms();
+    m_jiffies = 0;
+}
+
+void time_wheel::link(util_timer *head, util_timer *timer)
 {
-    util_timer *tmp = head;
-    while (tmp)
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void time_wheel::unlink(util_timer *timer)
+{
+    if (timer->prev)
     {
-        head = tmp->next;
-        delete tmp;
-        tmp = head;
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
     }
+    timer->prev = NULL;
+    timer->next = NULL;
 }
 
-void sort_timer_lst::add_timer(util_timer *timer)
+//按到期tick与当前tick的距离选择层和槽
+void time_wheel::internal_add(util_timer *timer)
 {
-    if (!timer)
+    time_t offset = timer->expire - m_base;
+    uint64_t expires = offset > 0 ? (offset + m_tick_ms - 1) / m_tick_ms : 0;
+    if (expires < m_jiffies)
+        expires = m_jiffies;
+
+    uint64_t delta = expires - m_jiffies;
+    if (delta < (uint64_t)ROOT_SIZE)
     {
+        link(&m_root[expires & (ROOT_SIZE - 1)], timer);
         return;
     }
-    if (!head)
+
+    int level = 0;
+    for (; level < LEVELS - 1; ++level)
     {
-        head = tail = timer;
-        return;
+        if (delta < ((uint64_t)1 << (ROOT_BITS + (level + 1) * LEVEL_BITS)))
+            break;
     }
-    if (timer->expire < head->expire)
+    //超出最高层覆盖范围的放在最高层最远的槽,到时会再次下放
+    uint64_t max_delta = ((uint64_t)1 << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+    if (delta > max_delta)
+        expires = m_jiffies + max_delta;
+
+    int index = (expires >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+    link(&m_levels[level][index], timer);
+}
+
+//把高层一个槽里的定时器按剩余时间重新放回更低的层
+void time_wheel::cascade(int level, int index)
+{
+    util_timer *head = &m_levels[level][index];
+    util_timer *tmp = head->next;
+    head->prev = head->next = head;
+    while (tmp != head)
     {
-        timer->next = head;
-        head->prev = timer;
-        head = timer;
-        return;
+        util_timer *next = tmp->next;
+        internal_add(tmp);
+        tmp = next;
     }
-    add_timer(timer, head);
 }
-void sort_timer_lst::adjust_timer(util_timer *timer)
+
+void time_wheel::add_timer(util_timer *timer)
 {
     if (!timer)
     {
         return;
     }
-    util_timer *tmp = timer->next;
-    if (!tmp || (timer->expire < tmp->expire))
-    {
-        return;
-    }
-    if (timer == head)
-    {
-        head = head->next;
-        head->prev = NULL;
-        timer->next = NULL;
-        add_timer(timer, head);
-    }
-    else
-    {
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        add_timer(timer, timer->next);
-    }
+    internal_add(timer);
 }
-void sort_timer_lst::del_timer(util_timer *timer)
+void time_wheel::adjust_timer(util_timer *timer)
 {
     if (!timer)
     {
         return;
     }
-    if ((timer == head) && (timer == tail))
-    {
-        delete timer;
-        head = NULL;
-        tail = NULL;
-        return;
-    }
-    if (timer == head)
-    {
-        head = head->next;
-        head->prev = NULL;
-        delete timer;
-        return;
-    }
-    if (timer == tail)
+    unlink(timer);
+    internal_add(timer);
+}
+void time_wheel::del_timer(util_timer *timer)
+{
+    if (!timer)
     {
-        tail = tail->prev;
-        tail->next = NULL;
-        delete timer;
         return;
     }
-    timer->prev->next = timer->next;
-    timer->next->prev = timer->prev;
+    unlink(timer);
     delete timer;
 }
-void sort_timer_lst::tick()
+void time_wheel::retry_timer(util_timer *timer)
+{
+    unlink(timer);
+    timer->timeout = 0;
+    timer->expire = m_base + (time_t)(m_jiffies + 1) * m_tick_ms;
+    //直接挂到下一个tick的槽,tick中调用时也不会挂回正在处理的槽
+    link(&m_root[(m_jiffies + 1) & (ROOT_SIZE - 1)], timer);
+}
+
+void time_wheel::tick()
+{
+    tick(monotonic_ms());
+}
+void time_wheel::tick(time_t now)
 {
-    if (!head)
+    if (now < m_base)
     {
         return;
     }
-    
-    time_t cur = time(NULL);
-    util_timer *tmp = head;
-    while (tmp)
+    uint64_t target = (now - m_base) / m_tick_ms;
+    while (m_jiffies <= target)
     {
-        if (cur < tmp->expire)
+        int index = m_jiffies & (ROOT_SIZE - 1);
+        //第0层转完一圈,从上一层下放一个槽,依次类推
+        for (int level = 0; level < LEVELS && 0 == index; ++level)
         {
-            break;
+            index = (m_jiffies >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+            cascade(level, index);
         }
-        tmp->cb_func(tmp->user_data);
-        head = tmp->next;
-        if (head)
-        {
-            head->prev = NULL;
-        }
-        delete tmp;
-        tmp = head;
-    }
-}
 
-void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head)
-{
-    util_timer *prev = lst_head;
-    util_timer *tmp = prev->next;
-    while (tmp)
-    {
-        if (timer->expire < tmp->expire)
+        util_timer *head = &m_root[m_jiffies & (ROOT_SIZE - 1)];
+        while (head->next != head)
         {
-            prev->next = timer;
-            timer->next = tmp;
-            tmp->prev = timer;
-            timer->prev = prev;
-            break;
+            util_timer *tmp = head->next;
+            unlink(tmp);
+
+            //惰性刷新的定时器,期间有过活动就按最后活动时间重新挂入
+            if (tmp->timeout && tmp->last_active + tmp->timeout > tmp->expire)
+            {
+                tmp->expire = tmp->last_active + tmp->timeout;
+                internal_add(tmp);
+                continue;
+            }
+            if (!tmp->cb_func(tmp->user_data))
+            {
+                retry_timer(tmp);
+                continue;
+            }
+            delete tmp;
         }
-        prev = tmp;
-        tmp = tmp->next;
-    }
-    if (!tmp)
-    {
-        prev->next = timer;
-        timer->prev = prev;
-        timer->next = NULL;
-        tail = timer;
+        ++m_jiffies;
     }
 }
 
-void Utils::init(int timeslot)
+void Utils::init(int timeslot, int tick_ms)
 {
     m_TIMESLOT = timeslot;
+    m_timer_lst.init(tick_ms);
 }
 
 //对文件描述符设置非阻塞
@@ -176,16 +211,6 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     setnonblocking(fd);
 }
 
-//信号处理函数
-void Utils::sig_handler(int sig)
-{
-    //为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    send(u_pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
 //设置信号函数
 void Utils::addsig(int sig, void(handler)(int), bool restart)
 {
@@ -198,11 +223,10 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
+//定时处理任务,由事件循环在timerfd到期时调用
 void Utils::timer_handler()
 {
     m_timer_lst.tick();
-    alarm(m_TIMESLOT);
 }
 
 void Utils::show_error(int connfd, const char *info)
@@ -211,14 +235,4 @@ void Utils::show_error(int connfd, const char *info)
     close(connfd);
 }
 
-int *Utils::u_pipefd = 0;
 int Utils::u_epollfd = 0;
-
-class Utils;
-void cb_func(client_data *user_data)
-{
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-}
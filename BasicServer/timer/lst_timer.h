@@ -25,44 +25,82 @@
 #include "../log/log.h"
 
 class util_timer;
+class time_wheel;
+class http_conn;
 
 struct client_data
 {
-    sockaddr_in address;
+    http_conn *conn;           //连接对象,关闭后归还并置空
     int sockfd;
+    int epollfd;               //连接所属事件循环的epoll
     util_timer *timer;
+    time_wheel *timer_lst;     //连接所属事件循环的时间轮
+    unsigned gen;              //连接代数,关闭时递增,用于识别fd复用前遗留的io_uring完成事件
+    bool closing;              //已摘掉epoll并shutdown,等工作线程交回连接后再回收
 };
 
+//单调时钟,毫秒
+time_t monotonic_ms();
+
 class util_timer
 {
 public:
-    util_timer() : prev(NULL), next(NULL) {}
+    util_timer() : last_active(0), timeout(0), prev(NULL), next(NULL) {}
 
 public:
-    time_t expire;
+    time_t expire;  //到期时间,monotonic_ms()的毫秒数
+
+    //惰性刷新:timeout非0时,读写事件只记录last_active,
+    //到期时若last_active + timeout仍在将来则重新挂回时间轮而不回调
+    time_t last_active;
+    time_t timeout;
     
-    void (* cb_func)(client_data *);
+    //返回false表示连接还不能回收,定时器由时间轮在下一个tick重试
+    bool (* cb_func)(client_data *);
     client_data *user_data;
     util_timer *prev;
     util_timer *next;
 };
 
-class sort_timer_lst
+//分层时间轮:第0层256个槽,每槽一个tick;其上3层各64个槽,每层一个槽覆盖下一层一整圈
+//插入、调整、删除都只是在槽的双向链表上摘挂,O(1);到期时高层槽的定时器逐级下放到第0层
+class time_wheel
 {
 public:
-    sort_timer_lst();
-    ~sort_timer_lst();
+    time_wheel();
+    ~time_wheel();
 
+    void init(int tick_ms);
     void add_timer(util_timer *timer);
     void adjust_timer(util_timer *timer);
     void del_timer(util_timer *timer);
+    //下一个tick再次到期,不再按活动时间惰性刷新
+    void retry_timer(util_timer *timer);
     void tick();
+    void tick(time_t now);
 
-private:
-    void add_timer(util_timer *timer, util_timer *lst_head);
+    //当前tick对应的时间,用于惰性刷新时打活动时间戳,不需要读时钟
+    time_t now() { return m_base + (time_t)m_jiffies * m_tick_ms; }
 
-    util_timer *head;
-    util_timer *tail;
+private:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int LEVELS = 3;
+
+    void internal_add(util_timer *timer);
+    void cascade(int level, int index);
+    static void link(util_timer *head, util_timer *timer);
+    static void unlink(util_timer *timer);
+
+    int m_tick_ms;
+    time_t m_base;      //第0个tick对应的时间
+    uint64_t m_jiffies; //下一个待处理的tick
+
+    //每个槽是一个带哨兵的循环双向链表
+    util_timer m_root[ROOT_SIZE];
+    util_timer m_levels[LEVELS][LEVEL_SIZE];
 };
 
 class Utils
@@ -71,7 +109,7 @@ public:
     Utils() {}
     ~Utils() {}
 
-    void init(int timeslot);
+    void init(int timeslot, int tick_ms);
 
     //对文件描述符设置非阻塞
     int setnonblocking(int fd);
@@ -79,24 +117,18 @@ public:
     //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
     void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
 
-    //信号处理函数
-    static void sig_handler(int sig);
-
     //设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
-    //定时处理任务，重新定时以不断触发SIGALRM信号
+    //定时处理任务,由事件循环在timerfd到期时调用
     void timer_handler();
 
     void show_error(int connfd, const char *info);
 
 public:
-    static int *u_pipefd;
-    sort_timer_lst m_timer_lst;
+    time_wheel m_timer_lst;
     static int u_epollfd;
     int m_TIMESLOT;
 };
 
-void cb_func(client_data *user_data);
-
 #endif
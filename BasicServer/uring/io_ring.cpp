@@ -0,0 +1,243 @@
+#include "io_ring.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+io_ring::io_ring()
+{
+    m_fd = -1;
+    m_sq_ptr = MAP_FAILED;
+    m_cq_ptr = MAP_FAILED;
+    m_sqes = (io_uring_sqe *)MAP_FAILED;
+    m_sqe_tail = 0;
+    m_submitted = 0;
+}
+
+io_ring::~io_ring()
+{
+    destroy();
+}
+
+bool io_ring::available()
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int fd = sys_io_uring_setup(2, &p);
+        supported = fd >= 0 ? 1 : 0;
+        if (fd >= 0)
+            close(fd);
+    }
+    return 1 == supported;
+}
+
+bool io_ring::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = sys_io_uring_setup(entries, &p);
+    if (m_fd < 0)
+        return false;
+
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    //新内核提交和完成队列共用一次映射
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        if (m_cq_size > m_sq_size)
+            m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        destroy();
+        return false;
+    }
+
+    if (single_mmap)
+        m_cq_ptr = m_sq_ptr;
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+        {
+            destroy();
+            return false;
+        }
+    }
+
+    m_sqes = (io_uring_sqe *)mmap(0, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        destroy();
+        return false;
+    }
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_entries = p.sq_entries;
+    m_sqe_tail = *m_sq_tail;
+    m_submitted = m_sqe_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+void io_ring::destroy()
+{
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sq_entries * sizeof(io_uring_sqe));
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_size);
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+    m_sq_ptr = MAP_FAILED;
+    m_cq_ptr = MAP_FAILED;
+    m_sqes = (io_uring_sqe *)MAP_FAILED;
+}
+
+io_uring_sqe *io_ring::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_backlog.empty() && m_sqe_tail - head >= m_sq_entries)
+    {
+        submit_and_wait(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    }
+    //已有积压时新请求排在后面,保持提交顺序
+    if (!m_backlog.empty() || m_sqe_tail - head >= m_sq_entries)
+    {
+        m_backlog.push_back(io_uring_sqe());
+        io_uring_sqe *sqe = &m_backlog.back();
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    unsigned index = m_sqe_tail & *m_sq_mask;
+    m_sq_array[index] = index;
+    m_sqe_tail++;
+
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+//把积压的请求按顺序放进提交队列的空位
+void io_ring::flush_backlog()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    size_t moved = 0;
+    while (moved < m_backlog.size() && m_sqe_tail - head < m_sq_entries)
+    {
+        unsigned index = m_sqe_tail & *m_sq_mask;
+        m_sq_array[index] = index;
+        m_sqe_tail++;
+        m_sqes[index] = m_backlog[moved++];
+    }
+    m_backlog.erase(m_backlog.begin(), m_backlog.begin() + moved);
+}
+
+io_uring_sqe *io_ring::prep(int op, int fd, __u64 user_data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+void io_ring::prep_accept(int fd, sockaddr *addr, socklen_t *addrlen, __u64 user_data)
+{
+    io_uring_sqe *sqe = prep(IORING_OP_ACCEPT, fd, user_data);
+    sqe->addr = (unsigned long)addr;
+    sqe->addr2 = (unsigned long)addrlen;
+}
+
+void io_ring::prep_recv(int fd, void *buf, unsigned len, __u64 user_data)
+{
+    io_uring_sqe *sqe = prep(IORING_OP_RECV, fd, user_data);
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+}
+
+void io_ring::prep_writev(int fd, const struct iovec *iov, int iov_count, __u64 user_data)
+{
+    io_uring_sqe *sqe = prep(IORING_OP_WRITEV, fd, user_data);
+    sqe->addr = (unsigned long)iov;
+    sqe->len = iov_count;
+}
+
+void io_ring::prep_read(int fd, void *buf, unsigned len, __u64 user_data)
+{
+    io_uring_sqe *sqe = prep(IORING_OP_READ, fd, user_data);
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+}
+
+int io_ring::submit_and_wait(unsigned wait_nr)
+{
+    //积压的请求分批放进队列先提交,最后一次才等待完成事件;内核一个也没取走时留到下次
+    while (!m_backlog.empty())
+    {
+        flush_backlog();
+        if (m_backlog.empty() || enter(0) <= 0)
+            break;
+    }
+    return enter(wait_nr);
+}
+
+int io_ring::enter(unsigned wait_nr)
+{
+    unsigned to_submit = m_sqe_tail - m_submitted;
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+
+    if (0 == to_submit && 0 == wait_nr)
+        return 0;
+
+    int ret = sys_io_uring_enter(m_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0)
+        return -errno;
+    m_submitted += ret;
+    return ret;
+}
+
+bool io_ring::next_cqe(io_uring_cqe *cqe)
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    *cqe = m_cqes[head & *m_cq_mask];
+    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
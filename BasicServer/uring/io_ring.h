@@ -0,0 +1,67 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <vector>
+
+//不依赖liburing,直接通过系统调用使用io_uring的提交/完成队列
+class io_ring
+{
+public:
+    io_ring();
+    ~io_ring();
+
+    //探测内核是否支持io_uring(内核版本或seccomp都可能禁用)
+    static bool available();
+
+    bool init(unsigned entries);
+    void destroy();
+    bool valid() { return m_fd >= 0; }
+
+    //取一个空闲的提交项,队列满时先把已填好的提交给内核
+    //内核仍未取走时(如完成队列溢出返回EBUSY)暂存到m_backlog,下次提交时再放进队列,不会丢请求
+    io_uring_sqe *get_sqe();
+
+    void prep_accept(int fd, sockaddr *addr, socklen_t *addrlen, __u64 user_data);
+    void prep_recv(int fd, void *buf, unsigned len, __u64 user_data);
+    void prep_writev(int fd, const struct iovec *iov, int iov_count, __u64 user_data);
+    void prep_read(int fd, void *buf, unsigned len, __u64 user_data);
+
+    //一次io_uring_enter同时提交全部新请求并等待至少wait_nr个完成事件,返回-errno表示失败
+    int submit_and_wait(unsigned wait_nr);
+
+    //取出下一个完成事件,没有时返回false
+    bool next_cqe(io_uring_cqe *cqe);
+
+private:
+    io_uring_sqe *prep(int op, int fd, __u64 user_data);
+    void flush_backlog();
+    int enter(unsigned wait_nr);
+
+    int m_fd;
+
+    //提交队列
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sq_entries;
+    io_uring_sqe *m_sqes;
+    unsigned m_sqe_tail;     //本地已填写的尾部,提交时才同步给内核
+    unsigned m_submitted;
+    std::vector<io_uring_sqe> m_backlog;  //提交队列放不下的请求,按顺序等待空位
+
+    //完成队列
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    io_uring_cqe *m_cqes;
+};
+
+#endif
@@ -2,9 +2,6 @@
 
 WebServer::WebServer()
 {
-    //http_conn类对象
-    users = new http_conn[MAX_FD];
-
     //root文件夹路径
     char server_path[200];
     getcwd(server_path, 200);
@@ -13,23 +10,37 @@ WebServer::WebServer()
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    //定时器
-    users_timer = new client_data[MAX_FD];
+    //定时器和连接对象指针,按fd下标;calloc的大块内存按页懒分配,只有用到的fd才占物理内存
+    users_timer = (client_data *)calloc(MAX_FD, sizeof(client_data));
+    assert(users_timer);
 }
 
 WebServer::~WebServer()
 {
-    close(m_epollfd);
-    close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
+    //先等工作线程退出,它们还会用到连接对象和事件循环的eventfd
     delete m_pool;
+    delete m_db_pool;
+    for (int i = 0; i < m_loop_num; ++i)
+    {
+        close(m_loops[i].epollfd);
+        if (m_loops[i].listenfd >= 0)
+            close(m_loops[i].listenfd);
+        if (m_loops[i].evfd >= 0)
+            close(m_loops[i].evfd);
+        close(m_loops[i].timerfd);
+    }
+    close(m_sigfd);
+    delete[] m_loops;
+    for (int i = 0; i < MAX_FD; ++i)
+        http_conn::destroy(users_timer[i].conn);
+    free(users_timer);
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model,
+                     int reactor_num, int io_backend, int tick_ms, int lazy_timer,
+                     int queue_size, int thread_max, int send_file,
+                     int cache_mb)
 {
     m_port = port;
     m_user = user;
@@ -37,11 +48,47 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_databaseName = databaseName;
     m_sql_num = sql_num;
     m_thread_num = thread_num;
+    m_thread_max = thread_max;
     m_log_write = log_write;
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+
+    //多reactor模式,每个事件循环一个线程,默认与在线CPU核数相同
+    m_loop_num = 1;
+    if (2 == m_actormodel)
+    {
+        m_loop_num = reactor_num > 0 ? reactor_num : sysconf(_SC_NPROCESSORS_ONLN);
+        if (m_loop_num <= 0)
+            m_loop_num = 1;
+    }
+    //主从reactor模式,第0个循环只负责accept,其后为从reactor
+    else if (3 == m_actormodel)
+    {
+        int sub_num = reactor_num > 0 ? reactor_num : sysconf(_SC_NPROCESSORS_ONLN);
+        m_loop_num = 1 + (sub_num > 0 ? sub_num : 1);
+    }
+    m_loops = NULL;
+    m_next_loop = 1;
+    m_stop_server = false;
+    m_io_uring = (1 == io_backend);
+    m_tick_ms = tick_ms > 0 ? tick_ms : TIMESLOT * 1000;
+    m_lazy_timer = (1 == lazy_timer);
+    m_sendfile = (1 == send_file);
+    m_cache_mb = cache_mb > 0 ? cache_mb : 0;
+    m_queue_size = queue_size > 0 ? queue_size : 10000;
+    m_high_water = m_queue_size * 3 / 4;
+    m_low_water = m_queue_size / 2;
+    m_shed_count = 0;
+    m_pause_count = 0;
+
+    //SIGTERM/SIGHUP改由signalfd接收,必须在创建日志、线程池等任何线程之前屏蔽,新线程会继承屏蔽字
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 }
 
 void WebServer::trig_mode()
@@ -91,31 +138,43 @@ void WebServer::sql_pool()
     m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
     //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    http_conn::initmysql_result(m_connPool, m_close_log);
 }
 
 void WebServer::thread_pool()
 {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new ThreadPool<http_conn>(m_actormodel, NULL, m_thread_num, m_queue_size,
+                                       m_thread_max, POOL_TARGET_WAIT_US, POOL_IDLE_MS);
+
+    //每个数据库线程最多占一个连接,多于连接数的线程只会阻塞在取连接上
+    m_db_pool = new ThreadPool<http_conn>(m_actormodel, m_connPool, m_sql_num, m_queue_size);
+    m_last_stats = m_pool->stats();
 }
 
-void WebServer::eventListen()
+void WebServer::static_cache()
+{
+    //静态文件缓存,inotify监视根目录,文件变化时自动失效
+    file_cache::get_instance()->init(m_root, (size_t)m_cache_mb << 20, m_close_log);
+}
+
+//创建监听socket,多reactor模式下每个循环各建一个并开启SO_REUSEPORT,由内核分摊新连接
+int WebServer::create_listenfd(bool reuse_port)
 {
     //网络编程基础步骤
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(listenfd >= 0);
 
     //优雅关闭连接
     if (0 == m_OPT_LINGER)
     {
         struct linger tmp = {0, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
     else if (1 == m_OPT_LINGER)
     {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
     int ret = 0;
@@ -126,84 +185,249 @@ void WebServer::eventListen()
     address.sin_port = htons(m_port);
 
     int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (reuse_port)
+    {
+        ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+        assert(ret >= 0);
+    }
+    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
+    ret = listen(listenfd, 5);
     assert(ret >= 0);
 
-    utils.init(TIMESLOT);
+    return listenfd;
+}
 
-    //epoll创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    m_epollfd = epoll_create(5);
-    assert(m_epollfd != -1);
+void WebServer::eventListen()
+{
+    int ret = 0;
+
+    //io_uring后端只接管由事件循环收发的模型,内核不支持时回退到epoll
+    if (m_io_uring && 0 != m_actormodel && 2 != m_actormodel)
+    {
+        LOG_WARN("%s", "io_uring backend needs actor_model 0 or 2, fall back to epoll");
+        m_io_uring = false;
+    }
+    if (m_io_uring && !io_ring::available())
+    {
+        LOG_WARN("%s", "io_uring is unavailable, fall back to epoll");
+        m_io_uring = false;
+    }
+
+    //reactor模式由工作线程读写,io_uring后端另有完成通知,两者都走同步处理
+#ifdef HTTP_COROUTINE
+    m_coroutine = !m_io_uring && 1 != m_actormodel;
+#else
+    m_coroutine = false;
+#endif
+
+    m_loops = new event_loop[m_loop_num];
+    for (int i = 0; i < m_loop_num; ++i)
+    {
+        event_loop *loop = &m_loops[i];
+        loop->index = i;
+        loop->server = this;
+        loop->tid = 0;
+        loop->listenfd = -1;
+        loop->evfd = -1;
+        loop->accept_paused = false;
+        loop->accept_armed = false;
+        loop->utils.init(TIMESLOT, m_tick_ms);
 
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
-    http_conn::m_epollfd = m_epollfd;
+        //epoll创建内核事件表
+        loop->epollfd = epoll_create(5);
+        assert(loop->epollfd != -1);
 
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret != -1);
-    utils.setnonblocking(m_pipefd[1]);
-    utils.addfd(m_epollfd, m_pipefd[0], false, 0);
+        //每个循环用自己的timerfd驱动定时器,间隔可配置到毫秒级
+        loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        assert(loop->timerfd >= 0);
+        struct itimerspec its;
+        its.it_value.tv_sec = m_tick_ms / 1000;
+        its.it_value.tv_nsec = (m_tick_ms % 1000) * 1000000L;
+        its.it_interval = its.it_value;
+        ret = timerfd_settime(loop->timerfd, 0, &its, NULL);
+        assert(ret == 0);
+
+        if (3 == m_actormodel && i > 0)
+        {
+            loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            assert(loop->evfd >= 0);
+            loop->utils.addfd(loop->epollfd, loop->evfd, false, 0);
+        }
+        else
+        {
+            loop->listenfd = create_listenfd(2 == m_actormodel && m_loop_num > 1);
+            loop->utils.addfd(loop->epollfd, loop->listenfd, false, m_LISTENTrigmode);
+        }
+
+        if (m_io_uring)
+        {
+            if (!loop->ring.init(URING_ENTRIES))
+            {
+                LOG_WARN("io_uring setup failed:errno is:%d, fall back to epoll", errno);
+                m_io_uring = false;
+                continue;
+            }
+            loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            assert(loop->evfd >= 0);
+        }
+
+#ifdef HTTP_COROUTINE
+        //工作线程通过eventfd把协程交回事件循环
+        if (m_coroutine)
+        {
+            if (loop->evfd < 0)
+            {
+                loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                assert(loop->evfd >= 0);
+                loop->utils.addfd(loop->epollfd, loop->evfd, false, 0);
+            }
+            loop->coro.offload = coro_offload;
+            loop->coro.resume = coro_resume;
+            loop->coro.close = coro_close;
+            loop->coro.shed = coro_shed;
+            loop->coro.arg = loop;
+            loop->coro.conn_pool = m_connPool;
+        }
+#endif
+    }
+    if (!m_io_uring)
+    {
+        for (int i = 0; i < m_loop_num; ++i)
+            m_loops[i].ring.destroy();
+    }
+
+    //信号统一由第0个循环通过signalfd处理,SIGTERM/SIGHUP已在init中屏蔽
+    Utils &utils = m_loops[0].utils;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    m_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(m_sigfd >= 0);
 
     utils.addsig(SIGPIPE, SIG_IGN);
-    utils.addsig(SIGALRM, utils.sig_handler, false);
-    utils.addsig(SIGTERM, utils.sig_handler, false);
 
-    alarm(TIMESLOT);
+    if (!m_io_uring)
+    {
+        for (int i = 0; i < m_loop_num; ++i)
+            utils.addfd(m_loops[i].epollfd, m_loops[i].timerfd, false, 0);
+        utils.addfd(m_loops[0].epollfd, m_sigfd, false, 0);
+    }
 
     //工具类,信号和描述符基础操作
-    Utils::u_pipefd = m_pipefd;
-    Utils::u_epollfd = m_epollfd;
+    Utils::u_epollfd = m_loops[0].epollfd;
+}
+
+//连接超时或出错时关闭连接,由时间轮和deal_timer回调
+//放在这里而不是lst_timer.cpp,定时器本身不依赖连接对象
+//连接还在工作线程手里时只摘掉epoll并shutdown,返回false,交回后再回收对象和fd
+static bool cb_func(client_data *user_data)
+{
+    assert(user_data);
+    if (!user_data->closing)
+    {
+        epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+        //io_uring后端可能还有挂起的收发请求引用该socket,先shutdown让其立即完成
+        shutdown(user_data->sockfd, SHUT_RDWR);
+        //之后交回的协程和io_uring完成事件按代数丢弃
+        user_data->gen++;
+        user_data->closing = true;
+    }
+    if (user_data->conn->busy())
+        return false;
+
+    //close之后fd可能马上被别的循环accept复用并填入新的连接对象,先回收旧的
+    http_conn::destroy(user_data->conn);
+    user_data->conn = NULL;
+    user_data->closing = false;
+    close(user_data->sockfd);
+    http_conn::m_user_count--;
+    return true;
 }
 
-void WebServer::timer(int connfd, struct sockaddr_in client_address)
+//连接对象分配失败时回一个忙并关闭fd,返回false
+bool WebServer::timer(event_loop *loop, int connfd, struct sockaddr_in client_address)
 {
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
+    //io_uring后端不把连接注册进epoll
+    int epollfd = m_io_uring ? -1 : loop->epollfd;
+    //io_uring后端只提交writev,没有sendfile
+    bool sendfile = m_sendfile && !m_io_uring;
+    http_conn *conn = http_conn::create();
+    if (!conn)
+    {
+        loop->utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "http_conn alloc failure");
+        return false;
+    }
+    conn->init(connfd, client_address, epollfd, m_root, m_CONNTrigmode, m_close_log, sendfile);
+#ifdef HTTP_COROUTINE
+    if (m_coroutine)
+    {
+        conn->coro_ctx = &loop->coro;
+        conn->coro_gen = users_timer[connfd].gen;
+    }
+#endif
 
     //初始化client_data数据
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-    users_timer[connfd].address = client_address;
+    users_timer[connfd].conn = conn;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].epollfd = epollfd;
+    users_timer[connfd].timer_lst = &loop->utils.m_timer_lst;
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    time_t cur = monotonic_ms();
+    timer->expire = cur + 3 * TIMESLOT * 1000;
+    if (m_lazy_timer)
+    {
+        timer->last_active = cur;
+        timer->timeout = 3 * TIMESLOT * 1000;
+    }
     users_timer[connfd].timer = timer;
-    utils.m_timer_lst.add_timer(timer);
+    loop->utils.m_timer_lst.add_timer(timer);
+    return true;
 }
 
 //若有数据传输，则将定时器往后延迟3个单位
 //并对新的定时器在链表上的位置进行调整
+//惰性模式下只记录活动时间,等原定时器到期时由时间轮重新挂入
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    utils.m_timer_lst.adjust_timer(timer);
+    if (m_lazy_timer)
+    {
+        timer->last_active = timer->user_data->timer_lst->now();
+        return;
+    }
+
+    time_t cur = monotonic_ms();
+    timer->expire = cur + 3 * TIMESLOT * 1000;
+    timer->user_data->timer_lst->adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
 }
 
 void WebServer::deal_timer(util_timer *timer, int sockfd)
 {
-    timer->cb_func(&users_timer[sockfd]);
-    if (timer)
-    {
-        utils.m_timer_lst.del_timer(timer);
-    }
+    //cb_func关闭fd后,该fd可能马上被其他循环accept复用,需先取出所属链表
+    time_wheel *timer_lst = users_timer[sockfd].timer_lst;
+    if (timer->cb_func(&users_timer[sockfd]))
+        timer_lst->del_timer(timer);
+    else
+        timer_lst->retry_timer(timer);
 
     LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
 
-bool WebServer::dealclinetdata()
+bool WebServer::dealclinetdata(event_loop *loop)
 {
     struct sockaddr_in client_address;
     socklen_t client_addrlength = sizeof(client_address);
     if (0 == m_LISTENTrigmode)
     {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        int connfd = accept(loop->listenfd, (struct sockaddr *)&client_address, &client_addrlength);
         if (connfd < 0)
         {
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
@@ -211,18 +435,21 @@ bool WebServer::dealclinetdata()
         }
         if (http_conn::m_user_count >= MAX_FD)
         {
-            utils.show_error(connfd, "Internal server busy");
+            loop->utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
-        timer(connfd, client_address);
+        if (3 == m_actormodel)
+            dispatch_conn(connfd, client_address);
+        else
+            timer(loop, connfd, client_address);
     }
 
     else
     {
         while (1)
         {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+            int connfd = accept(loop->listenfd, (struct sockaddr *)&client_address, &client_addrlength);
             if (connfd < 0)
             {
                 LOG_ERROR("%s:errno is:%d", "accept error", errno);
@@ -230,23 +457,76 @@ bool WebServer::dealclinetdata()
             }
             if (http_conn::m_user_count >= MAX_FD)
             {
-                utils.show_error(connfd, "Internal server busy");
+                loop->utils.show_error(connfd, "Internal server busy");
                 LOG_ERROR("%s", "Internal server busy");
                 break;
             }
-            timer(connfd, client_address);
+            if (3 == m_actormodel)
+                dispatch_conn(connfd, client_address);
+            else
+                timer(loop, connfd, client_address);
         }
         return false;
     }
     return true;
 }
 
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+//主reactor把新连接轮询交给从reactor,由从reactor在自己的线程里注册
+void WebServer::dispatch_conn(int connfd, struct sockaddr_in client_address)
+{
+    event_loop *loop = &m_loops[m_next_loop];
+    m_next_loop = (m_next_loop + 1 < m_loop_num) ? m_next_loop + 1 : 1;
+
+    accepted_conn conn;
+    conn.connfd = connfd;
+    conn.address = client_address;
+
+    loop->pending_lock.lock();
+    loop->pending.push_back(conn);
+    loop->pending_lock.unlock();
+
+    uint64_t one = 1;
+    if (::write(loop->evfd, &one, sizeof(one)) != sizeof(one))
+        LOG_ERROR("%s:errno is:%d", "eventfd write error", errno);
+}
+
+//从reactor取出主reactor投递的连接,初始化http_conn和定时器
+void WebServer::dealwithpending(event_loop *loop)
+{
+    uint64_t count;
+    if (read(loop->evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOG_ERROR("%s:errno is:%d", "eventfd read error", errno);
+
+    std::vector<accepted_conn> conns;
+    loop->pending_lock.lock();
+    conns.swap(loop->pending);
+    loop->pending_lock.unlock();
+
+    for (size_t i = 0; i < conns.size(); ++i)
+        timer(loop, conns[i].connfd, conns[i].address);
+
+#ifdef HTTP_COROUTINE
+    std::vector<conn_event> events;
+    loop->pending_lock.lock();
+    events.swap(loop->resumable);
+    loop->pending_lock.unlock();
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        //协程挂起期间连接已被关闭,fd可能已被复用,不能再碰这个连接
+        if (events[i].gen != users_timer[events[i].connfd].gen)
+            http_conn::destroy_coroutine(events[i].co);
+        else
+            http_conn::resume_coroutine(events[i].co);
+    }
+#endif
+}
+
+bool WebServer::dealwithsignal(bool &stop_server)
 {
     int ret = 0;
-    int sig;
-    char signals[1024];
-    ret = recv(m_pipefd[0], signals, sizeof(signals), 0);
+    signalfd_siginfo infos[8];
+    ret = read(m_sigfd, infos, sizeof(infos));
     if (ret == -1)
     {
         return false;
@@ -257,24 +537,131 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
     }
     else
     {
-        for (int i = 0; i < ret; ++i)
+        handle_signals(infos, ret / sizeof(signalfd_siginfo), stop_server);
+    }
+    return true;
+}
+
+void WebServer::handle_signals(const signalfd_siginfo *infos, int num, bool &stop_server)
+{
+    for (int i = 0; i < num; ++i)
+    {
+        switch (infos[i].ssi_signo)
         {
-            switch (signals[i])
-            {
-            case SIGALRM:
-            {
-                timeout = true;
-                break;
-            }
-            case SIGTERM:
-            {
-                stop_server = true;
-                break;
-            }
-            }
+        case SIGTERM:
+        {
+            stop_server = true;
+            break;
+        }
+        //SIGHUP不再终止进程,只把日志刷到磁盘
+        case SIGHUP:
+        {
+            LOG_INFO("%s", "SIGHUP received, flush log");
+            //刷盘交给工作线程,信号所在的事件循环不等磁盘;队列满时就在这里刷,不能丢掉这次刷盘
+            if (!m_pool->post([] { Log::get_instance()->flush(); }))
+                Log::get_instance()->flush();
+            LOG_INFO("overload stats: shed %llu requests, paused accept %llu times, %d static queued, %d db queued",
+                     (unsigned long long)m_shed_count, (unsigned long long)m_pause_count,
+                     m_pool->queued(), m_db_pool->queued());
+            log_pool_stats(true);
+            break;
+        }
         }
     }
-    return true;
+}
+
+//线程池伸缩后(或SIGHUP时)记录当前规模和扩缩次数,只在第0个循环调用
+void WebServer::log_pool_stats(bool force)
+{
+    pool_stats s = m_pool->stats();
+    if (!force && s.threads == m_last_stats.threads)
+        return;
+
+    LOG_INFO("thread pool %d -> %d threads (min %d, max %d), grown %llu, shrunk %llu, %d queued, service %ld us",
+             m_last_stats.threads, s.threads, s.min_threads, s.max_threads, s.grown, s.shrunk, s.queued, s.service_us);
+    size_t conns, ios, reserved;
+    http_conn::pool_usage(conns, ios, reserved);
+    LOG_INFO("connections %zu, io buffers %zu, %zu KB reserved", conns, ios, reserved / 1024);
+    m_last_stats = s;
+}
+
+//timerfd到期,读出到期次数后检查定时器链表
+void WebServer::dealwithtick(event_loop *loop, bool &timeout)
+{
+    uint64_t expirations;
+    if (read(loop->timerfd, &expirations, sizeof(expirations)) > 0)
+        timeout = true;
+}
+
+//io_uring请求的user_data:低32位为fd,其上8位为请求类型,高24位为连接代数
+enum URING_OP
+{
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_SIGNAL,
+    URING_NOTIFY,
+    URING_TICK
+};
+
+static inline __u64 uring_data(int op, int fd, unsigned gen)
+{
+    return (__u64)(unsigned)fd | ((__u64)op << 32) | ((__u64)(gen & 0xffffff) << 40);
+}
+
+//请求队列已满,由事件循环直接回预先拼好的503并关闭连接,不再让客户端等到超时
+static const char overload_503[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+void WebServer::shed_request(int sockfd)
+{
+    ++m_shed_count;
+    send(sockfd, overload_503, sizeof(overload_503) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    LOG_WARN("request queue full, shed client(%s)", inet_ntoa(users_timer[sockfd].conn->get_address()->sin_addr));
+    deal_timer(users_timer[sockfd].timer, sockfd);
+}
+
+//请求队列超过高水位时暂停accept,新连接留在内核backlog里,降到低水位后恢复
+void WebServer::check_overload(event_loop *loop)
+{
+    if (loop->listenfd < 0)
+        return;
+
+    int queued = std::max(m_pool->queued(), m_db_pool->queued());
+    if (!loop->accept_paused && queued >= m_high_water)
+    {
+        loop->accept_paused = true;
+        ++m_pause_count;
+        if (!m_io_uring)
+            epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, loop->listenfd, 0);
+        LOG_WARN("request queue above high water(%d/%d), pause accept", queued, m_queue_size);
+    }
+    else if (loop->accept_paused && queued <= m_low_water)
+    {
+        loop->accept_paused = false;
+        if (!m_io_uring)
+            loop->utils.addfd(loop->epollfd, loop->listenfd, false, m_LISTENTrigmode);
+        else if (!loop->accept_armed)
+        {
+            loop->accept_len = sizeof(loop->accept_addr);
+            loop->ring.prep_accept(loop->listenfd, (sockaddr *)&loop->accept_addr, &loop->accept_len, uring_data(URING_ACCEPT, loop->listenfd, 0));
+            loop->accept_armed = true;
+        }
+        LOG_INFO("request queue below low water(%d/%d), resume accept", queued, m_queue_size);
+    }
+}
+
+//按请求行分类后投递到对应的线程池,reactor模式下数据已在读缓冲区中,工作线程直接处理
+bool WebServer::dispatch_request(int sockfd)
+{
+    http_conn *conn = users_timer[sockfd].conn;
+    ThreadPool<http_conn> *pool = http_conn::STATIC_LANE == conn->request_lane() ? m_pool : m_db_pool;
+    if (1 == m_actormodel)
+        return pool->append(conn, 2);
+    return pool->append(conn);
 }
 
 void WebServer::dealwithread(int sockfd)
@@ -290,18 +677,32 @@ void WebServer::dealwithread(int sockfd)
         }
 
         //若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
+        //reactor模式下由工作线程读数据,读之前无法分类,先交给静态线程池,读完后由工作线程分类
+        if (!m_pool->append(users_timer[sockfd].conn, 0))
+        {
+            shed_request(sockfd);
+            return;
+        }
 
+        //deal_timer会回收连接对象,先清标志
+        http_conn *conn = users_timer[sockfd].conn;
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == conn->improv)
             {
-                if (1 == users[sockfd].timer_flag)
+                conn->improv = 0;
+                if (1 == conn->timer_flag)
                 {
+                    conn->timer_flag = 0;
                     deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                else if (1 == conn->lane_flag)
+                {
+                    //静态线程读到的是可能访问数据库的请求,数据已在读缓冲区中,转交数据库线程池
+                    conn->lane_flag = 0;
+                    if (!m_db_pool->append(conn, 2))
+                        shed_request(sockfd);
+                }
                 break;
             }
         }
@@ -309,12 +710,29 @@ void WebServer::dealwithread(int sockfd)
     else
     {
         //proactor
-        if (users[sockfd].read_once())
+        if (users_timer[sockfd].conn->read_once())
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("deal with the client(%s)", inet_ntoa(users_timer[sockfd].conn->get_address()->sin_addr));
+
+#ifdef HTTP_COROUTINE
+            if (m_coroutine)
+            {
+                //协程可能在本次调用中就关闭连接,先推迟定时器
+                if (timer)
+                {
+                    adjust_timer(timer);
+                }
+                users_timer[sockfd].conn->run_coroutine();
+                return;
+            }
+#endif
 
             //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            if (!dispatch_request(sockfd))
+            {
+                shed_request(sockfd);
+                return;
+            }
 
             if (timer)
             {
@@ -339,33 +757,48 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
+        //队列满时直接在事件循环里发送,响应已经生成,不能再回503
+        if (!m_pool->append(users_timer[sockfd].conn, 1))
+        {
+            if (!users_timer[sockfd].conn->write())
+                deal_timer(timer, sockfd);
+            else if (users_timer[sockfd].conn->buffered())
+                dealwithbuffered(sockfd);
+            return;
+        }
 
+        bool closed = false;
+        http_conn *conn = users_timer[sockfd].conn;
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == conn->improv)
             {
-                if (1 == users[sockfd].timer_flag)
+                conn->improv = 0;
+                if (1 == conn->timer_flag)
                 {
+                    conn->timer_flag = 0;
                     deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    closed = true;
                 }
-                users[sockfd].improv = 0;
                 break;
             }
         }
+        if (!closed && users_timer[sockfd].conn->buffered())
+            dealwithbuffered(sockfd);
     }
     else
     {
         //proactor
-        if (users[sockfd].write())
+        if (users_timer[sockfd].conn->write())
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", inet_ntoa(users_timer[sockfd].conn->get_address()->sin_addr));
 
             if (timer)
             {
                 adjust_timer(timer);
             }
+            if (users_timer[sockfd].conn->buffered())
+                dealwithbuffered(sockfd);
         }
         else
         {
@@ -374,14 +807,340 @@ void WebServer::dealwithwrite(int sockfd)
     }
 }
 
+//响应发完时读缓冲区里已有流水线上的下一个请求,不会再有读事件通知,直接交给工作线程或协程
+void WebServer::dealwithbuffered(int sockfd)
+{
+#ifdef HTTP_COROUTINE
+    if (m_coroutine)
+    {
+        users_timer[sockfd].conn->run_coroutine();
+        return;
+    }
+#endif
+    if (!dispatch_request(sockfd))
+        shed_request(sockfd);
+}
+
+//工作线程处理完请求后,把下一步交回连接所属的事件循环
+void WebServer::uring_notify(void *arg, http_conn *conn, int ev)
+{
+    event_loop *loop = (event_loop *)arg;
+    conn_event e;
+    e.connfd = conn->get_sockfd();
+    e.gen = loop->server->users_timer[e.connfd].gen;
+    e.ev = ev;
+
+    loop->pending_lock.lock();
+    loop->notified.push_back(e);
+    loop->pending_lock.unlock();
+
+    uint64_t one = 1;
+    ::write(loop->evfd, &one, sizeof(one));
+}
+
+#ifdef HTTP_COROUTINE
+//协程的阻塞操作按类别交给静态文件或数据库线程池
+bool WebServer::coro_offload(void *arg, int sockfd, int lane, task &&job)
+{
+    WebServer *server = ((event_loop *)arg)->server;
+    http_conn *conn = server->users_timer[sockfd].conn;
+    //任务会访问连接对象,交回前定时器不能回收它
+    conn->hold();
+    bool posted;
+    if (http_conn::STATIC_LANE == lane)
+        posted = server->m_pool->post(std::move(job));
+    else
+        posted = server->m_db_pool->post(std::move(job));
+    if (!posted)
+        conn->hand_back();
+    return posted;
+}
+
+//工作线程做完阻塞操作后,把协程交回连接所属的事件循环
+void WebServer::coro_resume(void *arg, int sockfd, unsigned gen, void *co)
+{
+    event_loop *loop = (event_loop *)arg;
+    //任务已做完,不再访问连接对象;之后连接可能被关闭,恢复时按代数判断
+    loop->server->users_timer[sockfd].conn->hand_back();
+
+    conn_event e;
+    e.connfd = sockfd;
+    e.gen = gen;
+    e.ev = 0;
+    e.co = co;
+
+    loop->pending_lock.lock();
+    loop->resumable.push_back(e);
+    loop->pending_lock.unlock();
+
+    uint64_t one = 1;
+    ::write(loop->evfd, &one, sizeof(one));
+}
+
+void WebServer::coro_close(void *arg, int sockfd)
+{
+    WebServer *server = ((event_loop *)arg)->server;
+    server->deal_timer(server->users_timer[sockfd].timer, sockfd);
+}
+
+void WebServer::coro_shed(void *arg, int sockfd)
+{
+    ((event_loop *)arg)->server->shed_request(sockfd);
+}
+#endif
+
+void WebServer::uring_accept(event_loop *loop, int connfd)
+{
+    if (http_conn::m_user_count >= MAX_FD)
+    {
+        loop->utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+    if (!timer(loop, connfd, loop->accept_addr))
+        return;
+    users_timer[connfd].conn->notify_func = uring_notify;
+    users_timer[connfd].conn->notify_arg = loop;
+    uring_recv(loop, connfd);
+}
+
+void WebServer::uring_recv(event_loop *loop, int sockfd)
+{
+    int len = 0;
+    char *buf = users_timer[sockfd].conn->read_space(len);
+    if (len <= 0)
+    {
+        deal_timer(users_timer[sockfd].timer, sockfd);
+        return;
+    }
+    loop->ring.prep_recv(sockfd, buf, len, uring_data(URING_RECV, sockfd, users_timer[sockfd].gen));
+}
+
+void WebServer::uring_send(event_loop *loop, int sockfd)
+{
+    struct iovec *iv = NULL;
+    int iv_count = users_timer[sockfd].conn->write_iov(iv);
+    if (0 == iv_count)
+    {
+        //没有待发送的数据,按发送完成处理
+        if (users_timer[sockfd].conn->write_done(0) < 0)
+            deal_timer(users_timer[sockfd].timer, sockfd);
+        else if (users_timer[sockfd].conn->buffered())
+            dealwithbuffered(sockfd);
+        else
+            uring_recv(loop, sockfd);
+        return;
+    }
+    loop->ring.prep_writev(sockfd, iv, iv_count, uring_data(URING_SEND, sockfd, users_timer[sockfd].gen));
+}
+
+//取出工作线程交回的连接,按其要求继续收、发或关闭
+void WebServer::uring_notified(event_loop *loop)
+{
+    std::vector<conn_event> events;
+    loop->pending_lock.lock();
+    events.swap(loop->notified);
+    loop->pending_lock.unlock();
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        int sockfd = events[i].connfd;
+        //连接已关闭,或通知发出前已开始关闭(代数已递增后才读到)
+        if (events[i].gen != users_timer[sockfd].gen || users_timer[sockfd].closing)
+            continue;
+
+        if (EPOLLIN == events[i].ev)
+            uring_recv(loop, sockfd);
+        else if (EPOLLOUT == events[i].ev)
+            uring_send(loop, sockfd);
+        else
+            deal_timer(users_timer[sockfd].timer, sockfd);
+    }
+}
+
+//io_uring事件循环:每轮用一次io_uring_enter提交本轮所有accept/recv/writev请求并等待完成
+void WebServer::run_uring_loop(event_loop *loop)
+{
+    bool timeout = false;
+    bool stop_server = false;
+    io_ring &ring = loop->ring;
+
+    if (loop->listenfd >= 0)
+    {
+        loop->accept_len = sizeof(loop->accept_addr);
+        ring.prep_accept(loop->listenfd, (sockaddr *)&loop->accept_addr, &loop->accept_len, uring_data(URING_ACCEPT, loop->listenfd, 0));
+        loop->accept_armed = true;
+    }
+    ring.prep_read(loop->evfd, &loop->ev_count, sizeof(loop->ev_count), uring_data(URING_NOTIFY, loop->evfd, 0));
+    ring.prep_read(loop->timerfd, &loop->tick_count, sizeof(loop->tick_count), uring_data(URING_TICK, loop->timerfd, 0));
+    if (0 == loop->index)
+        ring.prep_read(m_sigfd, loop->sig_info, sizeof(loop->sig_info), uring_data(URING_SIGNAL, m_sigfd, 0));
+
+    while (!stop_server && !m_stop_server)
+    {
+        int ret = ring.submit_and_wait(1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+        {
+            LOG_ERROR("io_uring failure:errno is:%d", -ret);
+            break;
+        }
+
+        io_uring_cqe cqe;
+        while (ring.next_cqe(&cqe))
+        {
+            int sockfd = (int)(cqe.user_data & 0xffffffff);
+            int op = (cqe.user_data >> 32) & 0xff;
+            unsigned gen = cqe.user_data >> 40;
+
+            switch (op)
+            {
+            case URING_ACCEPT:
+            {
+                if (cqe.res >= 0)
+                    uring_accept(loop, cqe.res);
+                else
+                    LOG_ERROR("%s:errno is:%d", "accept error", -cqe.res);
+                loop->accept_armed = false;
+                if (loop->accept_paused)
+                    break;
+                loop->accept_len = sizeof(loop->accept_addr);
+                ring.prep_accept(loop->listenfd, (sockaddr *)&loop->accept_addr, &loop->accept_len, cqe.user_data);
+                loop->accept_armed = true;
+                break;
+            }
+            case URING_RECV:
+            {
+                //fd关闭后遗留的完成事件
+                if (gen != (users_timer[sockfd].gen & 0xffffff))
+                    break;
+                util_timer *timer = users_timer[sockfd].timer;
+                if (cqe.res <= 0)
+                {
+                    deal_timer(timer, sockfd);
+                    break;
+                }
+                users_timer[sockfd].conn->read_done(cqe.res);
+                LOG_INFO("deal with the client(%s)", inet_ntoa(users_timer[sockfd].conn->get_address()->sin_addr));
+                if (!dispatch_request(sockfd))
+                {
+                    shed_request(sockfd);
+                    break;
+                }
+                if (timer)
+                    adjust_timer(timer);
+                break;
+            }
+            case URING_SEND:
+            {
+                if (gen != (users_timer[sockfd].gen & 0xffffff))
+                    break;
+                util_timer *timer = users_timer[sockfd].timer;
+                if (cqe.res < 0)
+                {
+                    users_timer[sockfd].conn->write_done(-1);
+                    deal_timer(timer, sockfd);
+                    break;
+                }
+                int left = users_timer[sockfd].conn->write_done(cqe.res);
+                if (left > 0)
+                    uring_send(loop, sockfd);
+                else if (0 == left)
+                {
+                    LOG_INFO("send data to the client(%s)", inet_ntoa(users_timer[sockfd].conn->get_address()->sin_addr));
+                    if (timer)
+                        adjust_timer(timer);
+                    if (users_timer[sockfd].conn->buffered())
+                        dealwithbuffered(sockfd);
+                    else
+                        uring_recv(loop, sockfd);
+                }
+                else
+                    deal_timer(timer, sockfd);
+                break;
+            }
+            case URING_SIGNAL:
+            {
+                if (cqe.res > 0)
+                    handle_signals(loop->sig_info, cqe.res / sizeof(signalfd_siginfo), stop_server);
+                ring.prep_read(m_sigfd, loop->sig_info, sizeof(loop->sig_info), cqe.user_data);
+                break;
+            }
+            case URING_NOTIFY:
+            {
+                uring_notified(loop);
+                ring.prep_read(loop->evfd, &loop->ev_count, sizeof(loop->ev_count), cqe.user_data);
+                break;
+            }
+            case URING_TICK:
+            {
+                if (cqe.res > 0)
+                    timeout = true;
+                ring.prep_read(loop->timerfd, &loop->tick_count, sizeof(loop->tick_count), cqe.user_data);
+                break;
+            }
+            }
+        }
+
+        if (timeout)
+        {
+            loop->utils.timer_handler();
+
+            LOG_INFO("%s", "timer tick");
+            if (0 == loop->index)
+                log_pool_stats(false);
+
+            timeout = false;
+        }
+        check_overload(loop);
+    }
+}
+
 void WebServer::eventLoop()
 {
+    //第0个循环在主线程运行,其余循环各占一个线程
+    for (int i = 1; i < m_loop_num; ++i)
+    {
+        if (pthread_create(&m_loops[i].tid, NULL, loop_worker, &m_loops[i]) != 0)
+        {
+            LOG_ERROR("%s", "create event loop thread failure");
+            m_stop_server = true;
+            break;
+        }
+    }
+
+    run_loop(&m_loops[0]);
+
+    m_stop_server = true;
+    for (int i = 1; i < m_loop_num; ++i)
+    {
+        if (m_loops[i].tid)
+            pthread_join(m_loops[i].tid, NULL);
+    }
+}
+
+void *WebServer::loop_worker(void *arg)
+{
+    event_loop *loop = (event_loop *)arg;
+    loop->server->run_loop(loop);
+    return loop;
+}
+
+void WebServer::run_loop(event_loop *loop)
+{
+    if (m_io_uring)
+    {
+        run_uring_loop(loop);
+        return;
+    }
+
     bool timeout = false;
     bool stop_server = false;
 
-    while (!stop_server)
+    epoll_event *events = loop->events;
+
+    while (!stop_server && !m_stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        int number = epoll_wait(loop->epollfd, events, MAX_EVENT_NUMBER, -1);
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -393,12 +1152,27 @@ void WebServer::eventLoop()
             int sockfd = events[i].data.fd;
 
             //处理新到的客户连接
-            if (sockfd == m_listenfd)
+            if (sockfd == loop->listenfd)
             {
-                bool flag = dealclinetdata();
+                bool flag = dealclinetdata(loop);
                 if (false == flag)
                     continue;
             }
+            //处理主reactor分发来的连接
+            else if (sockfd == loop->evfd)
+            {
+                dealwithpending(loop);
+            }
+            //定时器到期
+            else if (sockfd == loop->timerfd)
+            {
+                dealwithtick(loop, timeout);
+            }
+            //同一批事件中前面已关闭或正在关闭的连接
+            else if (sockfd != m_sigfd && (!users_timer[sockfd].conn || users_timer[sockfd].closing))
+            {
+                continue;
+            }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
                 //服务器端关闭连接，移除对应的定时器
@@ -406,9 +1180,9 @@ void WebServer::eventLoop()
                 deal_timer(timer, sockfd);
             }
             //处理信号
-            else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
+            else if ((sockfd == m_sigfd) && (events[i].events & EPOLLIN))
             {
-                bool flag = dealwithsignal(timeout, stop_server);
+                bool flag = dealwithsignal(stop_server);
                 if (false == flag)
                     LOG_ERROR("%s", "dealclientdata failure");
             }
@@ -424,11 +1198,14 @@ void WebServer::eventLoop()
         }
         if (timeout)
         {
-            utils.timer_handler();
+            loop->utils.timer_handler();
 
             LOG_INFO("%s", "timer tick");
+            if (0 == loop->index)
+                log_pool_stats(false);
 
             timeout = false;
         }
+        check_overload(loop);
     }
-}
\ No newline at end of file
+}
@@ -11,13 +11,75 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./uring/io_ring.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
 const int TIMESLOT = 5;             //最小超时单位
+const int URING_ENTRIES = 4096;     //io_uring提交队列长度
+const int POOL_TARGET_WAIT_US = 2000; //预计排队时间超过该值时线程池扩容
+const int POOL_IDLE_MS = 30000;     //工作线程空闲超过该时间后退出,不低于thread_num
+
+class WebServer;
+
+//主reactor accept后交给从reactor的连接
+struct accepted_conn
+{
+    int connfd;
+    sockaddr_in address;
+};
+
+//io_uring后端或协程模式下工作线程处理完请求后交回事件循环的通知
+struct conn_event
+{
+    int connfd;
+    unsigned gen;
+    int ev;
+    void *co;   //协程模式下待恢复的协程
+};
+
+//单个事件循环,多reactor模式下每个线程各持有一个
+struct event_loop
+{
+    int index;
+    int listenfd;                           //主从reactor模式下只有主reactor有
+    int epollfd;
+    int evfd;                               //主从reactor模式下接收新连接,io_uring后端和协程模式下接收工作线程的通知
+    int timerfd;                            //周期性触发定时器链表检查
+    locker pending_lock;
+    std::vector<accepted_conn> pending;     //主reactor投递、尚未注册的连接
+    std::vector<conn_event> notified;       //io_uring后端下工作线程交回的连接
+    std::vector<conn_event> resumable;      //协程模式下做完阻塞操作、等待恢复的协程
+    pthread_t tid;
+    WebServer *server;
+    Utils utils;                            //本循环独占的定时器链表
+    epoll_event events[MAX_EVENT_NUMBER];
+
+    //io_uring后端
+    io_ring ring;
+    sockaddr_in accept_addr;
+    socklen_t accept_len;
+    signalfd_siginfo sig_info[8];
+    uint64_t ev_count;
+    uint64_t tick_count;
+
+    //过载保护:请求队列超过高水位时暂停accept
+    bool accept_paused;
+    bool accept_armed;                      //io_uring后端下是否已有未完成的accept请求
+
+#ifdef HTTP_COROUTINE
+    coro_context coro;                      //本循环上连接的协程运行环境
+#endif
+};
 
 class WebServer
 {
@@ -27,21 +89,49 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int reactor_num,
+              int io_backend, int tick_ms, int lazy_timer,
+              int queue_size, int thread_max, int send_file,
+              int cache_mb);
 
     void thread_pool();
+    void static_cache();
     void sql_pool();
     void log_write();
     void trig_mode();
     void eventListen();
     void eventLoop();
-    void timer(int connfd, struct sockaddr_in client_address);
+    void run_loop(event_loop *loop);
+    static void *loop_worker(void *arg);
+    int create_listenfd(bool reuse_port);
+    bool timer(event_loop *loop, int connfd, struct sockaddr_in client_address);
     void adjust_timer(util_timer *timer);
     void deal_timer(util_timer *timer, int sockfd);
-    bool dealclinetdata();
-    bool dealwithsignal(bool& timeout, bool& stop_server);
+    bool dealclinetdata(event_loop *loop);
+    void dispatch_conn(int connfd, struct sockaddr_in client_address);
+    void dealwithpending(event_loop *loop);
+    bool dealwithsignal(bool& stop_server);
+    void handle_signals(const signalfd_siginfo *infos, int num, bool& stop_server);
+    void dealwithtick(event_loop *loop, bool& timeout);
+    void shed_request(int sockfd);
+    void check_overload(event_loop *loop);
+    void log_pool_stats(bool force);
+    bool dispatch_request(int sockfd);
+    void run_uring_loop(event_loop *loop);
+    void uring_recv(event_loop *loop, int sockfd);
+    void uring_send(event_loop *loop, int sockfd);
+    void uring_accept(event_loop *loop, int connfd);
+    void uring_notified(event_loop *loop);
+    static void uring_notify(void *arg, http_conn *conn, int ev);
+#ifdef HTTP_COROUTINE
+    static bool coro_offload(void *arg, int sockfd, int lane, task &&job);
+    static void coro_resume(void *arg, int sockfd, unsigned gen, void *co);
+    static void coro_close(void *arg, int sockfd);
+    static void coro_shed(void *arg, int sockfd);
+#endif
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    void dealwithbuffered(int sockfd);
 
 public:
     //基础
@@ -51,9 +141,19 @@ public:
     int m_close_log;
     int m_actormodel;
 
-    int m_pipefd[2];
-    int m_epollfd;
-    http_conn *users;
+    int m_sigfd;
+    int m_tick_ms;  //定时器检查间隔(毫秒)
+    bool m_lazy_timer; //读写事件只记录活动时间,到期时再重新计算
+    bool m_sendfile; //静态文件用sendfile发送,否则mmap后writev
+    int m_cache_mb;  //静态文件缓存上限(MB),0为不缓存
+
+    //事件循环相关,非多reactor模式下只有m_loops[0]
+    event_loop *m_loops;
+    int m_loop_num;
+    int m_next_loop; //主从reactor模式下轮询分发的下一个从reactor
+    bool m_io_uring; //是否使用io_uring后端
+    bool m_coroutine; //请求在事件循环上以协程处理,只有编译时打开HTTP_COROUTINE的epoll proactor模型使用
+    std::atomic<bool> m_stop_server;
 
     //数据库相关
     connection_pool *m_connPool;
@@ -62,14 +162,20 @@ public:
     string m_databaseName; //使用数据库名
     int m_sql_num;
 
-    //线程池相关
-    threadpool<http_conn> *m_pool;
+    //线程池相关,静态文件和数据库请求分开两组工作线程,慢查询不会拖住静态文件
+    ThreadPool<http_conn> *m_pool;      //静态文件,不持有数据库连接
+    ThreadPool<http_conn> *m_db_pool;   //登录、注册等可能访问数据库的请求,线程数与连接池相同
     int m_thread_num;
+    int m_thread_max;
+    int m_queue_size;
+    pool_stats m_last_stats; //上次记录的线程池状态,规模变化时写日志
 
-    //epoll_event相关
-    epoll_event events[MAX_EVENT_NUMBER];
+    //过载保护,高于高水位暂停accept,降到低水位恢复
+    int m_high_water;
+    int m_low_water;
+    std::atomic<unsigned long long> m_shed_count;   //直接回503的请求数
+    std::atomic<unsigned long long> m_pause_count;  //暂停accept的次数
 
-    int m_listenfd;
     int m_OPT_LINGER;
     int m_TRIGMode;
     int m_LISTENTrigmode;
@@ -77,6 +183,5 @@ public:
 
     //定时器相关
     client_data *users_timer;
-    Utils utils;
 };
 #endif